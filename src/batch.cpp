@@ -0,0 +1,215 @@
+#include "batch.h"
+
+#include "lod.h"
+#include "mesh.h"
+#include "profiling.h"
+#include "render.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+bool loadCameraPath(const char* path, std::vector<CameraFrame> & frames)
+{
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        fprintf(stderr, "Failed to open camera path: %s\n", path);
+        return false;
+    }
+
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        std::istringstream in(line);
+        std::vector<float> values;
+        float value;
+        while (in >> value)
+            values.push_back(value);
+        if (values.empty())
+            continue;
+
+        CameraFrame frame;
+        if (values.size() == 2) {
+            viewMatrix(frame.mvp, values[0], values[1]);
+        } else if (values.size() == 16) {
+            for (int c = 0; c < 4; c++)
+                for (int r = 0; r < 4; r++)
+                    frame.mvp[c][r] = values[4 * c + r];
+        } else {
+            fprintf(stderr, "%s:%d: expected 2 angles or 16 matrix values, got %zu\n", path, lineNumber, values.size());
+            return false;
+        }
+        frames.push_back(frame);
+    }
+    return true;
+}
+
+std::string meshName(const char* path)
+{
+    std::string name = path;
+    size_t slash = name.find_last_of("/\\");
+    if (slash != std::string::npos)
+        name = name.substr(slash + 1);
+    size_t dot = name.find_last_of('.');
+    if (dot != std::string::npos)
+        name = name.substr(0, dot);
+    return name;
+}
+
+namespace {
+
+struct BatchMesh {
+    std::string name;
+    std::vector<BVHNode> nodes;
+    std::vector<Triangle> triangles;
+    std::vector<LODLevel> lods;
+};
+
+struct FrameJob {
+    int mesh;
+    int frame;
+    int lod; // 0 for the full mesh, k for lods[k - 1]
+    std::once_flag allocated;
+    Image image;
+    std::atomic<int> tilesLeft{0};
+};
+
+}
+
+int runBatch(const BatchOptions & options)
+{
+    std::vector<CameraFrame> frames;
+    if (!loadCameraPath(options.cameraPath, frames))
+        return EXIT_FAILURE;
+    if (frames.empty() || options.meshes.empty()) {
+        fprintf(stderr, "batch needs at least one camera frame and one --mesh\n");
+        return EXIT_FAILURE;
+    }
+
+    // load and build everything up front, once per mesh
+    std::vector<BatchMesh> meshes(options.meshes.size());
+    for (size_t m = 0; m < options.meshes.size(); m++) {
+        aiVector3D min, max;
+        meshes[m].name = meshName(options.meshes[m]);
+        if (!loadMesh(options.meshes[m], meshes[m].triangles, min, max))
+            return EXIT_FAILURE;
+        buildAccelerationStructure(meshes[m].nodes, meshes[m].triangles, min, max, options.build);
+        printf("%s: %zu triangles, %zu nodes\n", meshes[m].name.c_str(), meshes[m].triangles.size(), meshes[m].nodes.size());
+        if (options.lodLevels > 0) {
+            buildLODs(meshes[m].triangles, min, max, options.build, options.lodLevels, meshes[m].lods);
+            for (size_t k = 0; k < meshes[m].lods.size(); k++) {
+                const LODLevel& lod = meshes[m].lods[k];
+                printf("  lod %zu: %zu triangles, %zu nodes, %.2f MB, cell %.5f\n", k + 1, lod.triangles.size(), lod.nodes.size(),
+                       (lod.nodes.size() * sizeof(BVHNode) + lod.triangles.size() * sizeof(Triangle)) / 1e6, lod.cellSize);
+            }
+        }
+    }
+    printStageTimings();
+
+    const int tileSize = std::max(1, options.tileSize);
+    const int tilesX = (options.width + tileSize - 1) / tileSize;
+    const int tilesY = (options.height + tileSize - 1) / tileSize;
+    const int tilesPerFrame = tilesX * tilesY;
+
+    std::vector<std::unique_ptr<FrameJob>> jobs;
+    for (int m = 0; m < (int) meshes.size(); m++) {
+        for (int f = 0; f < (int) frames.size(); f++) {
+            auto job = std::make_unique<FrameJob>();
+            job->mesh = m;
+            job->frame = f;
+            job->lod = selectLOD(meshes[m].lods, pixelFootprint(frames[f].mvp, options.width, options.height), options.lodBias);
+            job->tilesLeft = tilesPerFrame;
+            jobs.push_back(std::move(job));
+        }
+    }
+
+    // work items are handed out in (frame, tile) order, so only about one frame per thread
+    // is in flight and its image is freed as soon as the last tile lands
+    const long totalItems = (long) jobs.size() * tilesPerFrame;
+    std::atomic<long> nextItem{0};
+    std::atomic<long> totalRays{0};
+    std::atomic<int> framesWritten{0};
+    std::atomic<bool> writeFailed{false};
+
+    // rays and tracing time per lod level, to report rays/sec of each
+    size_t levels = 1;
+    for (const BatchMesh& mesh : meshes)
+        levels = std::max(levels, mesh.lods.size() + 1);
+    std::vector<std::atomic<long>> lodRays(levels);
+    std::vector<std::atomic<long>> lodMicroseconds(levels);
+    std::vector<int> lodFrames(levels, 0);
+    for (const auto& job : jobs)
+        lodFrames[job->lod]++;
+
+    auto worker = [&]() {
+        long rays = 0;
+        for (long item = nextItem++; item < totalItems; item = nextItem++) {
+            FrameJob& job = *jobs[item / tilesPerFrame];
+            int tile = item % tilesPerFrame;
+            std::call_once(job.allocated, [&]() {
+                job.image.width = options.width;
+                job.image.height = options.height;
+                job.image.pixels.resize((size_t) options.width * options.height * 3);
+            });
+
+            const BatchMesh& mesh = meshes[job.mesh];
+            const std::vector<BVHNode>& nodes = job.lod == 0 ? mesh.nodes : mesh.lods[job.lod - 1].nodes;
+            const std::vector<Triangle>& triangles = job.lod == 0 ? mesh.triangles : mesh.lods[job.lod - 1].triangles;
+            int x0 = (tile % tilesX) * tileSize;
+            int y0 = (tile / tilesX) * tileSize;
+            double tileStart = nowMs();
+            long tileRays = renderTile(nodes, triangles, frames[job.frame].mvp, job.image,
+                                       x0, y0, std::min(x0 + tileSize, options.width), std::min(y0 + tileSize, options.height), options.shading);
+            lodRays[job.lod] += tileRays;
+            lodMicroseconds[job.lod] += (long) ((nowMs() - tileStart) * 1000.0);
+            rays += tileRays;
+
+            if (--job.tilesLeft == 0) {
+                char path[1024];
+                snprintf(path, sizeof(path), "%s/%s_%04d.ppm", options.outDir.c_str(), mesh.name.c_str(), job.frame);
+                if (!writePPM(path, job.image))
+                    writeFailed = true;
+                std::vector<unsigned char>().swap(job.image.pixels);
+                framesWritten++;
+            }
+        }
+        totalRays += rays;
+    };
+
+    int threads = options.threads > 0 ? options.threads : (int) std::max(1u, std::thread::hardware_concurrency());
+    printf("rendering %zu frames of %dx%d in %d tiles each on %d threads, %s shading\n", jobs.size(), options.width, options.height,
+           tilesPerFrame, threads, shadingModeName(options.shading.mode));
+
+    double start = nowMs();
+    std::vector<std::thread> pool;
+    for (int t = 1; t < threads; t++)
+        pool.emplace_back(worker);
+    worker();
+    for (std::thread& t : pool)
+        t.join();
+    double seconds = (nowMs() - start) / 1000.0;
+
+    printf("%d frames in %.3f s: %.2f frames/s, %.3f Mrays/s\n",
+           framesWritten.load(), seconds, framesWritten / seconds, totalRays / seconds / 1e6);
+    if (options.shading.mode != ShadingMode::Normal) {
+        double samples = (double) framesWritten * options.width * options.height * std::max(1, options.shading.samples);
+        printf("%.3f Msamples/s, %.2f rays per sample\n", samples / seconds / 1e6, totalRays / samples);
+    }
+    if (levels > 1) {
+        for (size_t k = 0; k < levels; k++)
+            if (lodFrames[k] > 0)
+                printf("  lod %zu: %d frames, %.3f Mrays/s per thread\n", k, lodFrames[k], lodRays[k] / (lodMicroseconds[k] + 1.0));
+    }
+    return writeFailed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "bvh.h"
+#include "linmath.h"
+#include "render.h"
+
+#include <string>
+#include <vector>
+
+struct CameraFrame {
+    mat4x4 mvp;
+};
+
+// one frame per line, either "rotX rotY" in radians (the same angles the mouse drag sets)
+// or 16 floats giving the MVP matrix column by column. blank lines and lines starting with # are skipped
+bool loadCameraPath(const char* path, std::vector<CameraFrame> & frames);
+
+// file name without the directory or extension, used to name output files
+std::string meshName(const char* path);
+
+struct BatchOptions {
+    const char* cameraPath = nullptr;
+    std::vector<const char*> meshes;
+    std::string outDir = ".";
+    int width = 512;
+    int height = 512;
+    int tileSize = 32;
+    int threads = 0; // 0 uses every hardware thread
+    BuildSettings build;
+    ShadingOptions shading;
+    int lodLevels = 0;      // simplified levels built per mesh, each frame traces the one its pixel footprint allows
+    float lodBias = 1.0f;
+};
+
+// headless render of every camera frame for every mesh into <outDir>/<mesh name>_<frame>.ppm.
+// each mesh is loaded and built once, then all (mesh, frame, tile) work items go through one pool
+// so the cores stay busy across frame boundaries. returns the process exit code
+int runBatch(const BatchOptions & options);
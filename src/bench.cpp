@@ -0,0 +1,201 @@
+#include "bench.h"
+
+#include "kernels.h"
+#include "perf_counters.h"
+#include "profiling.h"
+
+#include <math.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <string>
+
+std::vector<std::pair<float, float>> benchmarkViews(int count)
+{
+    std::vector<std::pair<float, float>> views;
+    for (int i = 0; i < count; i++) {
+        float rotY = 6.2831853f * i / count;
+        float rotX = 0.6f * sinf(3.0f * rotY);
+        views.push_back({rotX, rotY});
+    }
+    return views;
+}
+
+template <typename Triangles>
+static TraceStats traceViewsWith(const std::vector<BVHNode>& nodes, const Triangles& triangles, int width, int height,
+                                 const std::vector<std::pair<float, float>>& views, IntersectMode mode)
+{
+    KernelConfig config;
+    config.intersect = mode;
+    auto kernel = selectKernel<typename Triangles::value_type>(config);
+
+    TraceStats stats;
+    double start = nowMs();
+    for (auto [rotX, rotY] : views) {
+        mat4x4 mvp;
+        viewMatrix(mvp, rotX, rotY);
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                vec3 ro, rd;
+                primaryRay(mvp, (x + 0.5f) / width, (y + 0.5f) / height, ro, rd);
+                Ray ray;
+                setupRay(ray, ro, rd);
+                HitInfo hit = kernel(nodes, triangles, ray, 1e30f, nullptr);
+                if (hit.tri != -1) {
+                    stats.hits++;
+                    stats.hitSum += hit.t;
+                }
+            }
+        }
+        stats.rays += (long) width * height;
+    }
+    stats.seconds = (nowMs() - start) / 1000.0;
+    return stats;
+}
+
+TraceStats traceViews(const std::vector<BVHNode>& nodes, const std::vector<Triangle>& triangles, int width, int height,
+                      const std::vector<std::pair<float, float>>& views, IntersectMode mode)
+{
+    return traceViewsWith(nodes, triangles, width, height, views, mode);
+}
+
+TraceStats traceViews(const std::vector<BVHNode>& nodes, const std::vector<PackedTriangle>& triangles, int width, int height,
+                      const std::vector<std::pair<float, float>>& views, IntersectMode mode)
+{
+    return traceViewsWith(nodes, triangles, width, height, views, mode);
+}
+
+void runLayoutBenchmark(const std::vector<BVHNode>& nodes, const std::vector<Triangle>& triangles, int root, int width, int height)
+{
+    const std::vector<std::pair<float, float>> views = benchmarkViews(8);
+
+    PerfCounters counters;
+    if (!counters.open())
+        printf("perf counters unavailable, only timing rays\n");
+
+    printf("%-10s %-9s %12s", "layout", "triangles", "Mrays/s");
+    if (counters.available) {
+        for (int c = 0; c < PerfCounters::COUNT; c++)
+            printf(" %14s", PerfCounters::name(c));
+        printf(" %12s", "miss/ray");
+    }
+    printf("\n");
+
+    for (NodeLayout layout : {NodeLayout::Recursion, NodeLayout::DepthFirst, NodeLayout::VanEmdeBoas, NodeLayout::Treelet}) {
+        for (bool reorder : {false, true}) {
+            std::vector<BVHNode> laidOut = nodes;
+            std::vector<Triangle> tris = triangles;
+            layoutBVH(laidOut, tris, root, layout, reorder);
+
+            // one untimed pass so every layout starts from the same warm state
+            traceViews(laidOut, tris, width / 4, height / 4, views);
+
+            counters.start();
+            TraceStats stats = traceViews(laidOut, tris, width, height, views);
+            counters.stop();
+
+            printf("%-10s %-9s %12.3f", nodeLayoutName(layout), reorder ? "reordered" : "as built", stats.rays / stats.seconds / 1e6);
+            if (counters.available) {
+                for (int c = 0; c < PerfCounters::COUNT; c++)
+                    printf(" %14llu", (unsigned long long) counters.values[c]);
+                printf(" %12.3f", (double) counters.values[PerfCounters::CacheMisses] / stats.rays);
+            }
+            printf("   (%ld hits, %.6g)\n", stats.hits, stats.hitSum);
+        }
+    }
+    counters.close();
+}
+
+void runIntersectBenchmark(const std::vector<BVHNode>& nodes, const std::vector<Triangle>& triangles, int width, int height)
+{
+    const std::vector<std::pair<float, float>> views = benchmarkViews(8);
+
+    printf("%-11s %12s %10s %14s\n", "intersect", "Mrays/s", "hits", "hit distance sum");
+    for (IntersectMode mode : {IntersectMode::Fast, IntersectMode::Watertight}) {
+        traceViews(nodes, triangles, width / 4, height / 4, views, mode);
+        TraceStats stats = traceViews(nodes, triangles, width, height, views, mode);
+        printf("%-11s %12.3f %10ld %14.6g\n", intersectModeName(mode), stats.rays / stats.seconds / 1e6, stats.hits, stats.hitSum);
+    }
+
+    // a pinhole is a ray the watertight test says hits the mesh that the fast one lets through,
+    // usually along an edge shared by two triangles
+    long pinholes = 0;
+    long extraHits = 0;
+    for (auto [rotX, rotY] : views) {
+        mat4x4 mvp;
+        viewMatrix(mvp, rotX, rotY);
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                vec3 ro, rd;
+                primaryRay(mvp, (x + 0.5f) / width, (y + 0.5f) / height, ro, rd);
+                bool fast = closestHitFromBVHStackless(nodes, triangles, ro, rd, IntersectMode::Fast).tri != -1;
+                bool watertight = closestHitFromBVHStackless(nodes, triangles, ro, rd, IntersectMode::Watertight).tri != -1;
+                pinholes += watertight && !fast;
+                extraHits += fast && !watertight;
+            }
+        }
+    }
+    printf("%ld pinholes in the fast test, %ld hits only the fast test found\n", pinholes, extraHits);
+}
+
+void runCompressBenchmark(std::vector<BVHNode>& nodes, const std::vector<Triangle>& triangles, int width, int height)
+{
+    const std::vector<std::pair<float, float>> views = benchmarkViews(8);
+
+    std::vector<PackedTriangle> packed;
+    float maxError;
+    bool withinBound = packTriangles(nodes, triangles, 0, packed, maxError);
+    printf("triangles: %.2f MB float, %.2f MB packed, max vertex error %.3g%s\n", triangles.size() * sizeof(Triangle) / 1e6,
+           packed.size() * sizeof(PackedTriangle) / 1e6, maxError, withinBound ? "" : " (past the bound)");
+
+    printf("%-8s %-11s %12s %10s %14s\n", "storage", "intersect", "Mrays/s", "hits", "hit distance sum");
+    for (IntersectMode mode : {IntersectMode::Fast, IntersectMode::Watertight}) {
+        traceViews(nodes, triangles, width / 4, height / 4, views, mode);
+        TraceStats stats = traceViews(nodes, triangles, width, height, views, mode);
+        printf("%-8s %-11s %12.3f %10ld %14.6g\n", "float", intersectModeName(mode), stats.rays / stats.seconds / 1e6, stats.hits, stats.hitSum);
+
+        traceViews(nodes, packed, width / 4, height / 4, views, mode);
+        stats = traceViews(nodes, packed, width, height, views, mode);
+        printf("%-8s %-11s %12.3f %10ld %14.6g\n", "packed", intersectModeName(mode), stats.rays / stats.seconds / 1e6, stats.hits, stats.hitSum);
+    }
+}
+
+void runShadingBenchmark(const std::vector<BVHNode>& nodes, const std::vector<Triangle>& triangles, int width, int height,
+                         const ShadingOptions& shading)
+{
+    const int TILE = 32;
+    const std::vector<std::pair<float, float>> views = benchmarkViews(2);
+
+    printf("%-8s %7s %7s %-14s %12s %12s %12s\n", "shading", "samples", "bounces", "ray order", "Msamples/s", "Mrays/s", "rays/sample");
+    for (ShadingMode mode : {ShadingMode::Normal, ShadingMode::AmbientOcclusion, ShadingMode::Diffuse}) {
+        for (RayOrder order : {RayOrder::Submission, RayOrder::OctantOrigin}) {
+            // primary rays only, nothing to sort
+            if (mode == ShadingMode::Normal && order != RayOrder::Submission)
+                continue;
+            ShadingOptions options = shading;
+            options.mode = mode;
+            options.rayOrder = order;
+            int samples = mode == ShadingMode::Normal ? 1 : std::max(1, options.samples);
+
+            Image image;
+            image.width = width;
+            image.height = height;
+            image.pixels.resize((size_t) width * height * 3);
+            long rays = 0;
+            double start = nowMs();
+            for (auto [rotX, rotY] : views) {
+                mat4x4 mvp;
+                viewMatrix(mvp, rotX, rotY);
+                for (int y = 0; y < height; y += TILE)
+                    for (int x = 0; x < width; x += TILE)
+                        rays += renderTile(nodes, triangles, mvp, image, x, y, std::min(x + TILE, width), std::min(y + TILE, height), options);
+            }
+            double seconds = (nowMs() - start) / 1000.0;
+            double sampleCount = (double) views.size() * width * height * samples;
+
+            printf("%-8s %7d %7s %-14s %12.3f %12.3f %12.2f\n", shadingModeName(mode), samples,
+                   mode == ShadingMode::Diffuse ? std::to_string(options.bounces).c_str() : "-",
+                   mode == ShadingMode::Normal ? "-" : rayOrderName(order), sampleCount / seconds / 1e6, rays / seconds / 1e6, rays / sampleCount);
+        }
+    }
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "bvh.h"
+#include "render.h"
+#include "trace.h"
+
+#include <utility>
+#include <vector>
+
+struct TraceStats {
+    double seconds = 0.0;
+    long rays = 0;
+    long hits = 0;
+    double hitSum = 0.0; // sum of hit distances, to check that two runs traced the same thing
+};
+
+// a ring of views around the mesh, the same ones every run
+std::vector<std::pair<float, float>> benchmarkViews(int count);
+
+// traces width * height primary rays per view on the calling thread with the stackless traversal
+TraceStats traceViews(const std::vector<BVHNode>& nodes, const std::vector<Triangle>& triangles, int width, int height,
+                      const std::vector<std::pair<float, float>>& views, IntersectMode mode = IntersectMode::Fast);
+TraceStats traceViews(const std::vector<BVHNode>& nodes, const std::vector<PackedTriangle>& triangles, int width, int height,
+                      const std::vector<std::pair<float, float>>& views, IntersectMode mode = IntersectMode::Fast);
+
+// rays/sec and cache counters for every node layout, with and without the triangle reorder
+void runLayoutBenchmark(const std::vector<BVHNode>& nodes, const std::vector<Triangle>& triangles, int root, int width, int height);
+
+// rays/sec of the fast and watertight intersection tests, and how many pixels the fast one lets through a crack
+void runIntersectBenchmark(const std::vector<BVHNode>& nodes, const std::vector<Triangle>& triangles, int width, int height);
+
+// triangle buffer size and rays/sec with float and packed triangles. nodes are packed in place, which only grows sbvh leaf boxes
+void runCompressBenchmark(std::vector<BVHNode>& nodes, const std::vector<Triangle>& triangles, int width, int height);
+
+// samples/sec and rays/sec of every shading mode over a few views in 32x32 tiles on one thread, with the secondary
+// rays traced as made and sorted. shading gives the sample count, bounce depth and ao distance
+void runShadingBenchmark(const std::vector<BVHNode>& nodes, const std::vector<Triangle>& triangles, int width, int height,
+                         const ShadingOptions& shading);
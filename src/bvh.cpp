@@ -0,0 +1,921 @@
+#include "bvh.h"
+
+#include "profiling.h"
+
+#include <float.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <utility>
+
+BVHNodeArena::BVHNodeArena(size_t maxNodes, size_t expectedNodes)
+{
+    // the chunk table is sized once for the worst case so it never moves while threads read it,
+    // the chunks themselves are only allocated when a block lands in them
+    chunks.resize((maxNodes + CHUNK_SIZE - 1) / CHUNK_SIZE + 1);
+    for (size_t c = 0; c * CHUNK_SIZE < expectedNodes && c < chunks.size(); c++) {
+        chunks[c].reset(new BVHNode[CHUNK_SIZE]);
+        chunkAllocations++;
+    }
+}
+
+int BVHNodeArena::allocate(ArenaCursor & cursor)
+{
+    if (cursor.next == cursor.end) {
+        int base = next.fetch_add(BLOCK_SIZE);
+        size_t chunk = base / CHUNK_SIZE;
+        if (chunk >= chunks.size()) {
+            fprintf(stderr, "bvh node arena overflow at %d nodes\n", base);
+            abort();
+        }
+        std::lock_guard<std::mutex> lock(chunkMutex);
+        if (!chunks[chunk]) {
+            chunks[chunk].reset(new BVHNode[CHUNK_SIZE]);
+            chunkAllocations++;
+        }
+        cursor.next = base;
+        cursor.end = base + BLOCK_SIZE;
+    }
+    int idx = cursor.next++;
+    (*this)[idx] = BVHNode{};
+    nodeCount++;
+    return idx;
+}
+
+int BVHNodeArena::finish(int root, std::vector<BVHNode> & out)
+{
+    // copy out in depth first order, which skips the unused tails of the blocks
+    // and gives the same order the recursive build used to produce
+    out.clear();
+    out.reserve(nodeCount);
+    struct Pending {
+        int idx;        // in the arena
+        int parentSlot; // in out
+        bool left;
+    };
+    std::vector<Pending> todo = {{root, -1, false}};
+    while (!todo.empty()) {
+        Pending p = todo.back();
+        todo.pop_back();
+
+        int slot = out.size();
+        out.push_back((*this)[p.idx]);
+        if (p.parentSlot != -1) {
+            if (p.left)
+                out[p.parentSlot].left = slot;
+            else
+                out[p.parentSlot].right = slot;
+        }
+        const BVHNode& node = (*this)[p.idx];
+        if (node.left != -1 || node.right != -1) {
+            todo.push_back({node.right, slot, false});
+            todo.push_back({node.left, slot, true});
+        }
+    }
+    return 0;
+}
+
+namespace {
+
+struct BuildContext {
+    BVHNodeArena& arena;
+    std::vector<Triangle>& triangles;
+    std::atomic<int> spareThreads;
+};
+
+// below this a subtree isn't worth a thread of its own
+const int PARALLEL_MIN_TRIS = 1 << 14;
+
+// claims one of the spare threads, never taking the count below zero so a failed claim leaves nothing to undo
+bool claimSpareThread(BuildContext & ctx)
+{
+    int spare = ctx.spareThreads.load();
+    while (spare > 0) {
+        if (ctx.spareThreads.compare_exchange_weak(spare, spare - 1))
+            return true;
+    }
+    return false;
+}
+
+//A must be a list of triangles inside 
+int buildBVHNode(BuildContext & ctx, ArenaCursor & cursor, int firstTri, int numTri, aiVector3D min, aiVector3D max, int lastAxis, int failedSplits)
+{
+    std::vector<Triangle> & triangles = ctx.triangles;
+    // arena nodes never move, so the reference stays valid across the child calls
+    int idx = ctx.arena.allocate(cursor);
+    BVHNode & node = ctx.arena[idx];
+
+    //rotate through all 3 axes
+    int axis = (lastAxis + 1) % 3;
+    
+    auto leftMin = min;
+    auto leftMax = max;
+    leftMax[axis] = (min[axis] + max[axis])/2;
+
+    auto rightMin = min;
+    auto rightMax = max;
+    rightMin[axis] = (min[axis] + max[axis])/2;
+
+    auto pivot = (min[axis] + max[axis])/2;
+    //loop through triangles, if centerpoint(?) is less than pivot put in left otherwise right
+    // store max overflow, expand left box size to cover that overflow
+    if (numTri != 0 && numTri != 1) { 
+        float maxPointInLeft = pivot;
+        float minPointInRight = pivot;
+        // partition in place, left side grows from firstTri and right side from the end
+        int leftCount = 0;
+        int rightStart = firstTri + numTri;
+        for (int i = firstTri; i < rightStart; ) {
+            const Triangle & tri = triangles[i];
+            float pos = (tri.v0[axis] + tri.v1[axis] + tri.v2[axis])/3;
+            // if triangle is on the boundary put into left side, then expand left side to fully cover
+            // this might not terminate, better way could be to use midpoint and grow both right and left side
+            if (pos < pivot) {
+                float maxVert = std::max(tri.v0[axis], std::max(tri.v1[axis], tri.v2[axis]));
+                if (maxVert > maxPointInLeft) {
+                    maxPointInLeft = maxVert;
+                }
+                leftCount++;
+                i++;
+            } else {
+                float minVert = std::min(tri.v0[axis], std::min(tri.v1[axis], tri.v2[axis]));
+                if (minVert < minPointInRight) {
+                    minPointInRight = minVert;
+                }
+                std::swap(triangles[i], triangles[--rightStart]);
+            }
+        }
+        int rightCount = numTri - leftCount;
+        //ensures all triangles are fully enclosed
+        // this could leave triangles which are actually in other bounding boxes and not counted. But every triangle will exist in exactly one box per level and the array wont be messed with (i hope)
+        if (maxPointInLeft > pivot) {
+            leftMax[axis] = maxPointInLeft;
+        }
+        if (minPointInRight < pivot) {
+            rightMin[axis] = minPointInRight;
+        }
+
+        //todo dont make extra children for efficiency
+        // Avoid infinite loop where it halves in the long axis but then a really long triangle in that axis just regrows it to the same size
+        //this causes early termination though
+        if (leftCount == numTri || rightCount == numTri) {
+            if (failedSplits == 2) {
+                node.left = -1;
+                node.right = -1;
+            } else {
+                node.left = buildBVHNode(ctx, cursor, firstTri, leftCount, leftMin, leftMax, axis, failedSplits + 1);
+                node.right = buildBVHNode(ctx, cursor, firstTri + leftCount, rightCount, rightMin, rightMax, axis, failedSplits + 1);
+            }
+        } else if (std::min(leftCount, rightCount) >= PARALLEL_MIN_TRIS && claimSpareThread(ctx)) {
+            // the two halves touch disjoint triangle ranges, and the other thread takes its own arena blocks
+            int left = -1;
+            std::thread leftThread([&]() {
+                ArenaCursor leftCursor;
+                left = buildBVHNode(ctx, leftCursor, firstTri, leftCount, leftMin, leftMax, axis, 0);
+            });
+            node.right = buildBVHNode(ctx, cursor, firstTri + leftCount, rightCount, rightMin, rightMax, axis, 0);
+            leftThread.join();
+            node.left = left;
+            ctx.spareThreads++;
+        } else {
+            node.left = buildBVHNode(ctx, cursor, firstTri, leftCount, leftMin, leftMax, axis, 0);
+            node.right = buildBVHNode(ctx, cursor, firstTri + leftCount, rightCount, rightMin, rightMax, axis, 0);
+        }
+
+    } else {
+        node.left = -1;
+        node.right = -1;
+    }
+    //todo add termination condition
+    node.firstTri = firstTri;
+    node.triCount = numTri;
+    node.boundsMin[0] = min.x;
+    node.boundsMin[1] = min.y;
+    node.boundsMin[2] = min.z;
+    node.boundsMax[0] = max.x;
+    node.boundsMax[1] = max.y;
+    node.boundsMax[2] = max.z;
+    return idx;
+}
+
+}
+
+size_t maxMidpointNodes(size_t numTri)
+{
+    // at most 2N-1 distinct triangle sets, and each one can fail to split twice before
+    // becoming a leaf, which adds a copy of itself plus an empty sibling each time
+    return 5 * std::max<size_t>(2 * numTri, 1);
+}
+
+int buildBVH(std::vector<BVHNode> & bounding_volumes, std::vector<Triangle> & triangles, aiVector3D min, aiVector3D max)
+{
+    return buildBVHRange(bounding_volumes, triangles, 0, triangles.size(), min, max, 0);
+}
+
+int buildBVHRange(std::vector<BVHNode> & bounding_volumes, std::vector<Triangle> & triangles, int firstTri, int numTri,
+                  aiVector3D min, aiVector3D max, int depth)
+{
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    BVHNodeArena arena(maxMidpointNodes(numTri) + (size_t) threads * BVHNodeArena::BLOCK_SIZE, 2 * (size_t) numTri);
+    BuildContext ctx{arena, triangles, {threads - 1}};
+    ArenaCursor cursor;
+    // the split axis rotates once per level starting from y at the root, so a subtree picks up where the full build would be
+    int root = buildBVHNode(ctx, cursor, firstTri, numTri, min, max, depth % 3, 0);
+    return arena.finish(root, bounding_volumes);
+}
+
+void linkBVH(std::vector<BVHNode> & bounding_volumes, int root)
+{
+    bounding_volumes[root].parent = -1;
+    bounding_volumes[root].escape = -1;
+    linkBVHSubtree(bounding_volumes, root);
+}
+
+void linkBVHSubtree(std::vector<BVHNode> & bounding_volumes, int root)
+{
+    // iterative so deep trees from long thin triangles can't blow the call stack
+    std::vector<int> todo = {root};
+    while (!todo.empty()) {
+        int idx = todo.back();
+        todo.pop_back();
+        BVHNode& node = bounding_volumes[idx];
+        if (node.left == -1 && node.right == -1) {
+            continue;
+        }
+        BVHNode& left = bounding_volumes[node.left];
+        BVHNode& right = bounding_volumes[node.right];
+        left.parent = idx;
+        right.parent = idx;
+        left.escape = node.right;
+        right.escape = node.escape;
+        todo.push_back(node.left);
+        todo.push_back(node.right);
+    }
+}
+
+int bvhDepth(const std::vector<BVHNode> & bounding_volumes, int root)
+{
+    int deepest = 0;
+    std::vector<std::pair<int, int>> todo = {{root, 1}};
+    while (!todo.empty()) {
+        auto [idx, depth] = todo.back();
+        todo.pop_back();
+        deepest = std::max(deepest, depth);
+        const BVHNode& node = bounding_volumes[idx];
+        if (node.left != -1)
+            todo.push_back({node.left, depth + 1});
+        if (node.right != -1)
+            todo.push_back({node.right, depth + 1});
+    }
+    return deepest;
+}
+
+void printBVHTriangles(BVHNode b) {
+    for (int i = b.firstTri; i < b.firstTri + b.triCount; i++) {
+        printf("%d ", i);
+    }
+    printf("\n");
+}
+
+namespace {
+
+struct AABB {
+    float mn[3] = {FLT_MAX, FLT_MAX, FLT_MAX};
+    float mx[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+
+    void grow(const float* p)
+    {
+        for (int i = 0; i < 3; i++) {
+            mn[i] = std::min(mn[i], p[i]);
+            mx[i] = std::max(mx[i], p[i]);
+        }
+    }
+    void grow(const AABB& b)
+    {
+        if (!b.valid())
+            return;
+        for (int i = 0; i < 3; i++) {
+            mn[i] = std::min(mn[i], b.mn[i]);
+            mx[i] = std::max(mx[i], b.mx[i]);
+        }
+    }
+    bool valid() const
+    {
+        return mn[0] <= mx[0] && mn[1] <= mx[1] && mn[2] <= mx[2];
+    }
+    float area() const
+    {
+        if (!valid())
+            return 0.0f;
+        float dx = mx[0] - mn[0], dy = mx[1] - mn[1], dz = mx[2] - mn[2];
+        return 2.0f * (dx * dy + dy * dz + dz * dx);
+    }
+    AABB intersect(const AABB& b) const
+    {
+        AABB r;
+        for (int i = 0; i < 3; i++) {
+            r.mn[i] = std::max(mn[i], b.mn[i]);
+            r.mx[i] = std::min(mx[i], b.mx[i]);
+        }
+        return r;
+    }
+};
+
+AABB triangleBounds(const Triangle& t)
+{
+    AABB b;
+    b.grow(t.v0);
+    b.grow(t.v1);
+    b.grow(t.v2);
+    return b;
+}
+
+// bounds of the part of the triangle between lo and hi on axis, kept inside the reference's current box
+AABB clipTriangle(const Triangle& t, int axis, float lo, float hi, const AABB& refBox)
+{
+    const float* v[3] = {t.v0, t.v1, t.v2};
+    AABB r;
+    for (int i = 0; i < 3; i++) {
+        const float* a = v[i];
+        const float* b = v[(i + 1) % 3];
+        if (a[axis] >= lo && a[axis] <= hi)
+            r.grow(a);
+        for (float plane : {lo, hi}) {
+            if ((a[axis] < plane && b[axis] > plane) || (a[axis] > plane && b[axis] < plane)) {
+                float s = (plane - a[axis]) / (b[axis] - a[axis]);
+                float p[3];
+                for (int k = 0; k < 3; k++)
+                    p[k] = a[k] + s * (b[k] - a[k]);
+                p[axis] = plane;
+                r.grow(p);
+            }
+        }
+    }
+    return r.intersect(refBox);
+}
+
+struct TriRef {
+    int tri;
+    AABB box;
+};
+
+struct Split {
+    float cost = FLT_MAX;
+    int axis = -1;
+    bool spatial = false;
+    int bin = 0;     // object split: last bin on the left
+    float pos = 0.0f; // spatial split: plane position
+    AABB left;
+    AABB right;
+    int leftCount = 0;
+    int rightCount = 0;
+};
+
+const int NUM_BINS = 32;
+const int MAX_DEPTH = 128;
+// SAH constants, traversal step vs one triangle test
+const float COST_TRAVERSAL = 1.0f;
+const float COST_INTERSECT = 1.0f;
+
+class SBVHBuilder {
+public:
+    SBVHBuilder(const std::vector<Triangle>& source, BVHNodeArena& nodes, std::vector<Triangle>& out, const SBVHOptions& options)
+        : source(source), nodes(nodes), out(out), options(options)
+    {
+        duplicatesLeft = (int) (options.splitBudget * source.size());
+    }
+
+    int build(std::vector<TriRef>& refs, const AABB& box, int depth)
+    {
+        if (depth == 0)
+            rootArea = std::max(box.area(), 1e-12f);
+
+        int idx = nodes.allocate(cursor);
+        int firstTri = out.size();
+
+        Split objectSplit;
+        Split spatialSplit;
+        if ((int) refs.size() > options.maxLeafSize && depth < MAX_DEPTH) {
+            objectSplit = findObjectSplit(refs, box);
+            if (duplicatesLeft > 0 && objectSplit.axis != -1) {
+                float overlap = objectSplit.left.intersect(objectSplit.right).area();
+                if (overlap / rootArea > options.overlapThreshold)
+                    spatialSplit = findSpatialSplit(refs, box);
+            }
+        }
+
+        std::vector<TriRef> leftRefs;
+        std::vector<TriRef> rightRefs;
+        if (spatialSplit.axis != -1 && spatialSplit.cost < objectSplit.cost) {
+            int budget = duplicatesLeft;
+            partitionSpatial(refs, spatialSplit, leftRefs, rightRefs);
+            // unsplitting can push everything to one side, the object split is still valid then
+            if (leftRefs.empty() || rightRefs.empty()) {
+                duplicatesLeft = budget;
+                leftRefs.clear();
+                rightRefs.clear();
+            }
+        }
+        if (leftRefs.empty() && rightRefs.empty() && objectSplit.axis != -1) {
+            partitionObject(refs, objectSplit, leftRefs, rightRefs);
+        } else if (leftRefs.empty() && rightRefs.empty() && (int) refs.size() > options.maxLeafSize && depth < MAX_DEPTH) {
+            // no object split came back, either because every centroid is in the same place so no plane separates
+            // them, or because SAH found a leaf cheaper than any split. either way there are still more references
+            // than a leaf may hold, so just cut the list in half
+            leftRefs.assign(refs.begin(), refs.begin() + refs.size() / 2);
+            rightRefs.assign(refs.begin() + refs.size() / 2, refs.end());
+        }
+
+        if (leftRefs.empty() || rightRefs.empty()) {
+            for (const TriRef& r : refs)
+                out.push_back(source[r.tri]);
+            nodes[idx].left = -1;
+            nodes[idx].right = -1;
+        } else {
+            // the parent's list isn't needed anymore, free it before going deeper
+            std::vector<TriRef>().swap(refs);
+            AABB leftBox, rightBox;
+            for (const TriRef& r : leftRefs)
+                leftBox.grow(r.box);
+            for (const TriRef& r : rightRefs)
+                rightBox.grow(r.box);
+            int left = build(leftRefs, leftBox, depth + 1);
+            int right = build(rightRefs, rightBox, depth + 1);
+            nodes[idx].left = left;
+            nodes[idx].right = right;
+        }
+
+        nodes[idx].firstTri = firstTri;
+        nodes[idx].triCount = out.size() - firstTri;
+        for (int i = 0; i < 3; i++) {
+            nodes[idx].boundsMin[i] = box.mn[i];
+            nodes[idx].boundsMax[i] = box.mx[i];
+        }
+        return idx;
+    }
+
+private:
+    float sahCost(const AABB& left, int leftCount, const AABB& right, int rightCount, const AABB& parent) const
+    {
+        return COST_TRAVERSAL + COST_INTERSECT * (left.area() * leftCount + right.area() * rightCount) / std::max(parent.area(), 1e-12f);
+    }
+
+    static int objectBin(const TriRef& r, int axis, float cmin, float cmax)
+    {
+        float c = (r.box.mn[axis] + r.box.mx[axis]) * 0.5f;
+        int bin = (int) (NUM_BINS * (c - cmin) / (cmax - cmin));
+        return std::clamp(bin, 0, NUM_BINS - 1);
+    }
+
+    Split findObjectSplit(const std::vector<TriRef>& refs, const AABB& box)
+    {
+        AABB centroids;
+        for (const TriRef& r : refs) {
+            float c[3];
+            for (int i = 0; i < 3; i++)
+                c[i] = (r.box.mn[i] + r.box.mx[i]) * 0.5f;
+            centroids.grow(c);
+        }
+
+        Split best;
+        best.cost = COST_INTERSECT * refs.size();
+        for (int axis = 0; axis < 3; axis++) {
+            float cmin = centroids.mn[axis];
+            float cmax = centroids.mx[axis];
+            if (cmax - cmin <= 0.0f)
+                continue;
+
+            AABB bins[NUM_BINS];
+            int counts[NUM_BINS] = {};
+            for (const TriRef& r : refs) {
+                int bin = objectBin(r, axis, cmin, cmax);
+                bins[bin].grow(r.box);
+                counts[bin]++;
+            }
+
+            // sweep from the right so each split can be scored in one pass from the left
+            AABB rightBoxes[NUM_BINS];
+            int rightCounts[NUM_BINS];
+            AABB acc;
+            int count = 0;
+            for (int i = NUM_BINS - 1; i > 0; i--) {
+                acc.grow(bins[i]);
+                count += counts[i];
+                rightBoxes[i] = acc;
+                rightCounts[i] = count;
+            }
+            acc = AABB();
+            count = 0;
+            for (int i = 0; i < NUM_BINS - 1; i++) {
+                acc.grow(bins[i]);
+                count += counts[i];
+                if (count == 0 || rightCounts[i + 1] == 0)
+                    continue;
+                float cost = sahCost(acc, count, rightBoxes[i + 1], rightCounts[i + 1], box);
+                if (cost < best.cost) {
+                    best.cost = cost;
+                    best.axis = axis;
+                    best.spatial = false;
+                    best.bin = i;
+                    best.left = acc;
+                    best.right = rightBoxes[i + 1];
+                    best.leftCount = count;
+                    best.rightCount = rightCounts[i + 1];
+                }
+            }
+        }
+        return best;
+    }
+
+    Split findSpatialSplit(const std::vector<TriRef>& refs, const AABB& box)
+    {
+        Split best;
+        for (int axis = 0; axis < 3; axis++) {
+            float lo = box.mn[axis];
+            float extent = box.mx[axis] - lo;
+            if (extent <= 0.0f)
+                continue;
+            float binSize = extent / NUM_BINS;
+
+            AABB bins[NUM_BINS];
+            int entries[NUM_BINS] = {};
+            int exits[NUM_BINS] = {};
+            for (const TriRef& r : refs) {
+                int first = std::clamp((int) ((r.box.mn[axis] - lo) / binSize), 0, NUM_BINS - 1);
+                int last = std::clamp((int) ((r.box.mx[axis] - lo) / binSize), first, NUM_BINS - 1);
+                for (int i = first; i <= last; i++) {
+                    float binLo = i == first ? r.box.mn[axis] : lo + i * binSize;
+                    float binHi = i == last ? r.box.mx[axis] : lo + (i + 1) * binSize;
+                    bins[i].grow(clipTriangle(source[r.tri], axis, binLo, binHi, r.box));
+                }
+                entries[first]++;
+                exits[last]++;
+            }
+
+            AABB rightBoxes[NUM_BINS];
+            int rightCounts[NUM_BINS];
+            AABB acc;
+            int count = 0;
+            for (int i = NUM_BINS - 1; i > 0; i--) {
+                acc.grow(bins[i]);
+                count += exits[i];
+                rightBoxes[i] = acc;
+                rightCounts[i] = count;
+            }
+            acc = AABB();
+            count = 0;
+            for (int i = 0; i < NUM_BINS - 1; i++) {
+                acc.grow(bins[i]);
+                count += entries[i];
+                if (count == 0 || rightCounts[i + 1] == 0)
+                    continue;
+                float cost = sahCost(acc, count, rightBoxes[i + 1], rightCounts[i + 1], box);
+                if (cost < best.cost) {
+                    best.cost = cost;
+                    best.axis = axis;
+                    best.spatial = true;
+                    best.pos = lo + (i + 1) * binSize;
+                    best.left = acc;
+                    best.right = rightBoxes[i + 1];
+                    best.leftCount = count;
+                    best.rightCount = rightCounts[i + 1];
+                }
+            }
+        }
+        return best;
+    }
+
+    void partitionObject(const std::vector<TriRef>& refs, const Split& split, std::vector<TriRef>& leftRefs, std::vector<TriRef>& rightRefs)
+    {
+        AABB centroids;
+        for (const TriRef& r : refs) {
+            float c[3];
+            for (int i = 0; i < 3; i++)
+                c[i] = (r.box.mn[i] + r.box.mx[i]) * 0.5f;
+            centroids.grow(c);
+        }
+        for (const TriRef& r : refs) {
+            if (objectBin(r, split.axis, centroids.mn[split.axis], centroids.mx[split.axis]) <= split.bin)
+                leftRefs.push_back(r);
+            else
+                rightRefs.push_back(r);
+        }
+    }
+
+    void partitionSpatial(const std::vector<TriRef>& refs, const Split& split, std::vector<TriRef>& leftRefs, std::vector<TriRef>& rightRefs)
+    {
+        int axis = split.axis;
+        AABB leftBox, rightBox;
+        std::vector<TriRef> straddling;
+        for (const TriRef& r : refs) {
+            if (r.box.mx[axis] <= split.pos) {
+                leftRefs.push_back(r);
+                leftBox.grow(r.box);
+            } else if (r.box.mn[axis] >= split.pos) {
+                rightRefs.push_back(r);
+                rightBox.grow(r.box);
+            } else {
+                straddling.push_back(r);
+            }
+        }
+
+        int leftCount = split.leftCount;
+        int rightCount = split.rightCount;
+        for (const TriRef& r : straddling) {
+            // reference unsplitting: keeping the whole triangle on one side can beat duplicating it,
+            // and once the budget is spent that is the only option
+            AABB leftGrown = leftBox;
+            leftGrown.grow(r.box);
+            AABB rightGrown = rightBox;
+            rightGrown.grow(r.box);
+            AABB leftClipped = clipTriangle(source[r.tri], axis, -FLT_MAX, split.pos, r.box);
+            AABB rightClipped = clipTriangle(source[r.tri], axis, split.pos, FLT_MAX, r.box);
+            AABB leftSplit = leftBox;
+            leftSplit.grow(leftClipped);
+            AABB rightSplit = rightBox;
+            rightSplit.grow(rightClipped);
+
+            float costSplit = leftSplit.area() * leftCount + rightSplit.area() * rightCount;
+            float costLeft = leftGrown.area() * leftCount + rightBox.area() * (rightCount - 1);
+            float costRight = leftBox.area() * (leftCount - 1) + rightGrown.area() * rightCount;
+
+            bool canSplit = duplicatesLeft > 0 && leftClipped.valid() && rightClipped.valid();
+            if (canSplit && costSplit < costLeft && costSplit < costRight) {
+                leftRefs.push_back({r.tri, leftClipped});
+                rightRefs.push_back({r.tri, rightClipped});
+                leftBox = leftSplit;
+                rightBox = rightSplit;
+                duplicatesLeft--;
+            } else if (costLeft <= costRight) {
+                leftRefs.push_back(r);
+                leftBox = leftGrown;
+                rightCount--;
+            } else {
+                rightRefs.push_back(r);
+                rightBox = rightGrown;
+                leftCount--;
+            }
+        }
+    }
+
+    const std::vector<Triangle>& source;
+    BVHNodeArena& nodes;
+    ArenaCursor cursor;
+    std::vector<Triangle>& out;
+    const SBVHOptions& options;
+    int duplicatesLeft = 0;
+    float rootArea = 1.0f;
+};
+
+}
+
+int buildSBVH(std::vector<BVHNode> & bounding_volumes, std::vector<Triangle> & triangles, const SBVHOptions & options)
+{
+    std::vector<Triangle> source;
+    source.swap(triangles);
+    triangles.reserve(source.size() + (size_t) (options.splitBudget * source.size()));
+
+    std::vector<TriRef> refs(source.size());
+    AABB box;
+    for (int i = 0; i < (int) source.size(); i++) {
+        refs[i] = {i, triangleBounds(source[i])};
+        box.grow(refs[i].box);
+    }
+
+    // every reference ends up in a leaf of at least one, so 2 * references bounds the node count
+    size_t maxRefs = source.size() + (size_t) (options.splitBudget * source.size());
+    BVHNodeArena arena(2 * maxRefs + BVHNodeArena::BLOCK_SIZE, 2 * source.size());
+    SBVHBuilder builder(source, arena, triangles, options);
+    int root = builder.build(refs, box, 0);
+    return arena.finish(root, bounding_volumes);
+}
+
+float bvhSiblingOverlap(const std::vector<BVHNode> & bounding_volumes, int root)
+{
+    auto toAABB = [](const BVHNode& n) {
+        AABB b;
+        b.grow(n.boundsMin);
+        b.grow(n.boundsMax);
+        return b;
+    };
+    float rootArea = std::max(toAABB(bounding_volumes[root]).area(), 1e-12f);
+    float overlap = 0.0f;
+    std::vector<int> todo = {root};
+    while (!todo.empty()) {
+        const BVHNode& node = bounding_volumes[todo.back()];
+        todo.pop_back();
+        if (node.left == -1 || node.right == -1)
+            continue;
+        overlap += toAABB(bounding_volumes[node.left]).intersect(toAABB(bounding_volumes[node.right])).area();
+        todo.push_back(node.left);
+        todo.push_back(node.right);
+    }
+    return overlap / rootArea;
+}
+
+const char* nodeLayoutName(NodeLayout layout)
+{
+    switch (layout) {
+    case NodeLayout::Recursion: return "recursion";
+    case NodeLayout::DepthFirst: return "dfs";
+    case NodeLayout::VanEmdeBoas: return "veb";
+    case NodeLayout::Treelet: return "treelet";
+    }
+    return "?";
+}
+
+bool parseNodeLayout(const char* name, NodeLayout & layout)
+{
+    for (NodeLayout l : {NodeLayout::Recursion, NodeLayout::DepthFirst, NodeLayout::VanEmdeBoas, NodeLayout::Treelet}) {
+        if (std::string(name) == nodeLayoutName(l)) {
+            layout = l;
+            return true;
+        }
+    }
+    return false;
+}
+
+namespace {
+
+bool isLeaf(const BVHNode& n)
+{
+    return n.left == -1 && n.right == -1;
+}
+
+void orderRecursion(const std::vector<BVHNode>& nodes, int root, std::vector<int>& order)
+{
+    std::vector<int> todo = {root};
+    while (!todo.empty()) {
+        int idx = todo.back();
+        todo.pop_back();
+        order.push_back(idx);
+        if (!isLeaf(nodes[idx])) {
+            todo.push_back(nodes[idx].right);
+            todo.push_back(nodes[idx].left);
+        }
+    }
+}
+
+void orderDepthFirst(const std::vector<BVHNode>& nodes, int root, std::vector<int>& order)
+{
+    // a node's children are written together when the node is visited, so both
+    // child boxes the traversal tests next share a cache line pair
+    order.push_back(root);
+    std::vector<int> todo = {root};
+    while (!todo.empty()) {
+        int idx = todo.back();
+        todo.pop_back();
+        if (isLeaf(nodes[idx]))
+            continue;
+        order.push_back(nodes[idx].left);
+        order.push_back(nodes[idx].right);
+        todo.push_back(nodes[idx].right);
+        todo.push_back(nodes[idx].left);
+    }
+}
+
+void collectAtDepth(const std::vector<BVHNode>& nodes, int idx, int depth, std::vector<int>& out)
+{
+    if (depth == 0) {
+        out.push_back(idx);
+        return;
+    }
+    if (isLeaf(nodes[idx]))
+        return;
+    collectAtDepth(nodes, nodes[idx].left, depth - 1, out);
+    collectAtDepth(nodes, nodes[idx].right, depth - 1, out);
+}
+
+// lays out the first `levels` levels below root
+void orderVanEmdeBoas(const std::vector<BVHNode>& nodes, int root, int levels, std::vector<int>& order)
+{
+    if (levels == 1 || isLeaf(nodes[root])) {
+        order.push_back(root);
+        return;
+    }
+    int top = levels / 2;
+    int bottom = levels - top;
+    orderVanEmdeBoas(nodes, root, top, order);
+    std::vector<int> frontier;
+    collectAtDepth(nodes, root, top, frontier);
+    for (int sub : frontier)
+        orderVanEmdeBoas(nodes, sub, bottom, order);
+}
+
+float nodeArea(const BVHNode& n)
+{
+    float dx = n.boundsMax[0] - n.boundsMin[0];
+    float dy = n.boundsMax[1] - n.boundsMin[1];
+    float dz = n.boundsMax[2] - n.boundsMin[2];
+    return 2.0f * (dx * dy + dy * dz + dz * dx);
+}
+
+void orderTreelet(const std::vector<BVHNode>& nodes, int root, std::vector<int>& order)
+{
+    // 64 nodes of 64 bytes is one 4k page
+    const int TREELET_SIZE = 4096 / sizeof(BVHNode);
+
+    std::vector<int> roots = {root};
+    while (!roots.empty()) {
+        int treeletRoot = roots.back();
+        roots.pop_back();
+
+        // grow the treelet by the node a ray is most likely to reach next, surface area being the usual stand in
+        auto smaller = [&](int a, int b) { return nodeArea(nodes[a]) < nodeArea(nodes[b]); };
+        std::vector<int> frontier = {treeletRoot};
+        int count = 0;
+        while (!frontier.empty() && count < TREELET_SIZE) {
+            std::pop_heap(frontier.begin(), frontier.end(), smaller);
+            int idx = frontier.back();
+            frontier.pop_back();
+            order.push_back(idx);
+            count++;
+            if (!isLeaf(nodes[idx])) {
+                frontier.push_back(nodes[idx].left);
+                std::push_heap(frontier.begin(), frontier.end(), smaller);
+                frontier.push_back(nodes[idx].right);
+                std::push_heap(frontier.begin(), frontier.end(), smaller);
+            }
+        }
+        // whatever didn't fit starts its own treelet, largest ones first
+        std::sort(frontier.begin(), frontier.end(), smaller);
+        roots.insert(roots.end(), frontier.begin(), frontier.end());
+    }
+}
+
+}
+
+void layoutBVH(std::vector<BVHNode> & bounding_volumes, std::vector<Triangle> & triangles, int root, NodeLayout layout, bool reorderTriangles)
+{
+    std::vector<int> order;
+    order.reserve(bounding_volumes.size());
+    switch (layout) {
+    case NodeLayout::Recursion:
+        orderRecursion(bounding_volumes, root, order);
+        break;
+    case NodeLayout::DepthFirst:
+        orderDepthFirst(bounding_volumes, root, order);
+        break;
+    case NodeLayout::VanEmdeBoas:
+        orderVanEmdeBoas(bounding_volumes, root, bvhDepth(bounding_volumes, root), order);
+        break;
+    case NodeLayout::Treelet:
+        orderTreelet(bounding_volumes, root, order);
+        break;
+    }
+
+    std::vector<int> newIndex(bounding_volumes.size(), -1);
+    for (int i = 0; i < (int) order.size(); i++)
+        newIndex[order[i]] = i;
+
+    std::vector<BVHNode> reordered(order.size());
+    for (int i = 0; i < (int) order.size(); i++) {
+        reordered[i] = bounding_volumes[order[i]];
+        if (!isLeaf(reordered[i])) {
+            reordered[i].left = newIndex[reordered[i].left];
+            reordered[i].right = newIndex[reordered[i].right];
+        }
+    }
+    bounding_volumes.swap(reordered);
+    linkBVH(bounding_volumes, 0);
+
+    if (!reorderTriangles)
+        return;
+
+    std::vector<Triangle> packed;
+    packed.reserve(triangles.size());
+    for (BVHNode& node : bounding_volumes) {
+        if (!isLeaf(node)) {
+            node.firstTri = -1;
+            continue;
+        }
+        int first = packed.size();
+        packed.insert(packed.end(), triangles.begin() + node.firstTri, triangles.begin() + node.firstTri + node.triCount);
+        node.firstTri = first;
+    }
+    triangles.swap(packed);
+}
+
+int buildAccelerationStructure(std::vector<BVHNode> & bounding_volumes, std::vector<Triangle> & triangles, aiVector3D min, aiVector3D max, const BuildSettings & settings)
+{
+    {
+    ScopedTimer timer("bvh build");
+    int root;
+    if (settings.sbvh)
+        root = buildSBVH(bounding_volumes, triangles, settings.sbvhOptions);
+    else
+        root = buildBVH(bounding_volumes, triangles, min, max);
+    linkBVH(bounding_volumes, root);
+    }
+
+    if (settings.layout != NodeLayout::Recursion || settings.reorderTriangles)
+    {
+        ScopedTimer timer("bvh layout");
+        layoutBVH(bounding_volumes, triangles, 0, settings.layout, settings.reorderTriangles);
+    }
+    return 0;
+}
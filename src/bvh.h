@@ -0,0 +1,156 @@
+#pragma once
+
+#include <assimp/scene.h>
+
+#include <string.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// array of triangles
+// array of boxes -> pointer to children, list of faces in them
+
+// top level A is all faces
+// build child -> pass through faces and put into either left right or both
+// nlogn
+//split over largest axis
+// build in xyz axes
+//if triangle is on border, always assign it to first, then expand first to overlap second so it fully covers those triangles
+
+struct alignas(16) Triangle {
+    float v0[4];   // xyz + source triangle id (see triangleId)
+    float v1[4];
+    float v2[4];
+    float normal[4];
+};
+
+// index of the triangle in the loaded mesh. kept in v0's padding as raw int bits so it survives
+// the builders reordering and duplicating triangles
+inline int triangleId(const Triangle & t)
+{
+    int id;
+    memcpy(&id, &t.v0[3], sizeof(id));
+    return id;
+}
+
+inline void setTriangleId(Triangle & t, int id)
+{
+    memcpy(&t.v0[3], &id, sizeof(id));
+}
+
+struct alignas(16) BVHNode {
+    float boundsMin[4]; // xyz + padding
+    float boundsMax[4];
+    int left;
+    int right;
+    int firstTri;
+    int triCount;
+    // filled in by linkBVH after the build, used by the stackless traversal
+    int parent; // -1 for the root
+    int escape; // next node to visit once this subtree is done, -1 ends the traversal
+    int pad[2];
+};
+
+// a thread's current block of arena slots
+struct ArenaCursor {
+    int next = 0;
+    int end = 0;
+};
+
+// node storage for the builders. nodes live in fixed size chunks that are never moved or grown,
+// so a node reference stays valid for the whole build and nothing gets copied on the way.
+// threads take BLOCK_SIZE slots at a time from a shared counter and fill them through their own cursor.
+class BVHNodeArena {
+public:
+    static const int CHUNK_SIZE = 1 << 16;
+    static const int BLOCK_SIZE = 1 << 10;
+
+    // maxNodes sizes the chunk table (the build aborts past it), expectedNodes worth of chunks are allocated up front
+    BVHNodeArena(size_t maxNodes, size_t expectedNodes);
+
+    int allocate(ArenaCursor & cursor);
+    BVHNode & operator[](int idx) { return chunks[idx / CHUNK_SIZE][idx % CHUNK_SIZE]; }
+
+    // copies the tree below root into out in depth first order, sized exactly, and returns the new root (0)
+    int finish(int root, std::vector<BVHNode> & out);
+
+    std::atomic<int> nodeCount{0};
+    std::atomic<int> chunkAllocations{0};
+
+private:
+    std::vector<std::unique_ptr<BVHNode[]>> chunks;
+    std::atomic<int> next{0};
+    std::mutex chunkMutex;
+};
+
+// upper bound on the nodes the midpoint builder makes for numTri triangles
+size_t maxMidpointNodes(size_t numTri);
+
+// the original midpoint split builder, splitting the big subtrees across threads. returns the root index.
+int buildBVH(std::vector<BVHNode> & bounding_volumes, std::vector<Triangle> & triangles, aiVector3D min, aiVector3D max);
+
+// the midpoint builder over triangles[firstTri, firstTri + numTri) only, into a fresh bounding_volumes. depth is where
+// the subtree root sits in the whole tree, which decides its split axis. returns the root index (0)
+int buildBVHRange(std::vector<BVHNode> & bounding_volumes, std::vector<Triangle> & triangles, int firstTri, int numTri,
+                  aiVector3D min, aiVector3D max, int depth);
+
+// writes parent and escape links into every node below root.
+// the escape of a left child is its sibling, the escape of a right child is its parent's escape,
+// so a traversal can walk the whole tree with just the current index: on a box hit go to left, otherwise (or after a leaf) go to escape
+void linkBVH(std::vector<BVHNode> & bounding_volumes, int root);
+
+// the same below root, keeping root's own parent and escape. for relinking a subtree rebuilt in place
+void linkBVHSubtree(std::vector<BVHNode> & bounding_volumes, int root);
+
+// number of levels below and including root
+int bvhDepth(const std::vector<BVHNode> & bounding_volumes, int root);
+
+void printBVHTriangles(BVHNode b);
+
+// past this the budget is no limit at all, the reference list it reserves is just wasted memory
+const float MAX_SPLIT_BUDGET = 16.0f;
+
+struct SBVHOptions {
+    // extra triangle references spatial splits may add, as a fraction of the triangle count, 0 to MAX_SPLIT_BUDGET
+    float splitBudget = 0.3f;
+    // only try a spatial split when the object split children overlap by more than this fraction of the root area
+    float overlapThreshold = 1e-5f;
+    int maxLeafSize = 4;
+};
+
+// spatial split bvh (Stich et al. 2009). binned SAH over both object splits and spatial splits,
+// where a spatial split clips the triangles crossing the plane and references them from both sides.
+// triangles is replaced by the leaf ordered list, duplicated triangles are copied so every node
+// still covers one contiguous range. returns the root index.
+int buildSBVH(std::vector<BVHNode> & bounding_volumes, std::vector<Triangle> & triangles, const SBVHOptions & options);
+
+// surface area of the overlap between every pair of siblings, summed and divided by the root area
+float bvhSiblingOverlap(const std::vector<BVHNode> & bounding_volumes, int root);
+
+// where nodes sit in bounding_volumes after the build
+enum class NodeLayout {
+    Recursion,   // as built, parent then whole left subtree then right subtree
+    DepthFirst,  // depth first, but the two children of a node are always next to each other
+    VanEmdeBoas, // recursively split by height, top half of the tree first then each bottom subtree
+    Treelet,     // greedy clusters of the largest surface area nodes, sized to fill a page
+};
+
+const char* nodeLayoutName(NodeLayout layout);
+bool parseNodeLayout(const char* name, NodeLayout & layout);
+
+// reorders bounding_volumes (root ends up at 0) and rewrites the child, parent and escape links.
+// with reorderTriangles the leaf ranges in triangles are also packed in the order the leaves now sit in memory,
+// which breaks the contiguous ranges of inner nodes, so those get firstTri = -1 (triCount still counts the triangles below)
+void layoutBVH(std::vector<BVHNode> & bounding_volumes, std::vector<Triangle> & triangles, int root, NodeLayout layout, bool reorderTriangles);
+
+struct BuildSettings {
+    bool sbvh = false; // midpoint builder otherwise
+    SBVHOptions sbvhOptions;
+    NodeLayout layout = NodeLayout::Recursion;
+    bool reorderTriangles = false;
+};
+
+// build, link and lay out a bvh over triangles, timed as the "bvh build" and "bvh layout" stages. returns the root (0)
+int buildAccelerationStructure(std::vector<BVHNode> & bounding_volumes, std::vector<Triangle> & triangles, aiVector3D min, aiVector3D max, const BuildSettings & settings);
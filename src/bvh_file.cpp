@@ -0,0 +1,137 @@
+#include "bvh_file.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char BVH_FILE_MAGIC[8] = {'M', 'E', 'S', 'H', 'B', 'V', 'H', '1'};
+const uint64_t BVH_FILE_ALIGN = 4096;
+
+struct BVHFileHeader {
+    char magic[8];
+    uint32_t nodeSize;     // sizeof(BVHNode) and sizeof(Triangle) of the build that wrote it
+    uint32_t triangleSize;
+    uint64_t nodeCount;
+    uint64_t triangleCount;
+    uint64_t nodeOffset;
+    uint64_t triangleOffset;
+};
+
+uint64_t alignUp(uint64_t offset)
+{
+    return (offset + BVH_FILE_ALIGN - 1) / BVH_FILE_ALIGN * BVH_FILE_ALIGN;
+}
+
+}
+
+bool saveBVHFile(const char* path, std::span<const BVHNode> nodes, std::span<const Triangle> triangles)
+{
+    BVHFileHeader header;
+    memcpy(header.magic, BVH_FILE_MAGIC, sizeof(header.magic));
+    header.nodeSize = sizeof(BVHNode);
+    header.triangleSize = sizeof(Triangle);
+    header.nodeCount = nodes.size();
+    header.triangleCount = triangles.size();
+    header.nodeOffset = alignUp(sizeof(header));
+    header.triangleOffset = alignUp(header.nodeOffset + nodes.size_bytes());
+
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "Failed to open bvh file for writing: %s\n", path);
+        return false;
+    }
+    static const char zeros[BVH_FILE_ALIGN] = {};
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = ok && fwrite(zeros, 1, header.nodeOffset - sizeof(header), file) == header.nodeOffset - sizeof(header);
+    ok = ok && fwrite(nodes.data(), 1, nodes.size_bytes(), file) == nodes.size_bytes();
+    uint64_t gap = header.triangleOffset - header.nodeOffset - nodes.size_bytes();
+    ok = ok && fwrite(zeros, 1, gap, file) == gap;
+    ok = ok && fwrite(triangles.data(), 1, triangles.size_bytes(), file) == triangles.size_bytes();
+    ok = fclose(file) == 0 && ok;
+    if (!ok)
+        fprintf(stderr, "Failed to write bvh file: %s\n", path);
+    return ok;
+}
+
+#ifndef _WIN32
+
+bool MappedBVH::open(const char* path)
+{
+    close();
+
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open bvh file: %s\n", path);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(BVHFileHeader)) {
+        fprintf(stderr, "Not a bvh file: %s\n", path);
+        ::close(fd);
+        return false;
+    }
+    size = st.st_size;
+    data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    // the mapping keeps the file alive, the descriptor isn't needed any more
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Failed to map bvh file: %s\n", path);
+        data = nullptr;
+        size = 0;
+        return false;
+    }
+
+    BVHFileHeader header;
+    memcpy(&header, data, sizeof(header));
+    bool valid = memcmp(header.magic, BVH_FILE_MAGIC, sizeof(header.magic)) == 0
+        && header.nodeSize == sizeof(BVHNode) && header.triangleSize == sizeof(Triangle)
+        && header.nodeOffset % BVH_FILE_ALIGN == 0 && header.triangleOffset % BVH_FILE_ALIGN == 0
+        && header.nodeOffset <= size
+        && header.nodeCount <= (size - header.nodeOffset) / sizeof(BVHNode)
+        && header.triangleOffset >= header.nodeOffset + header.nodeCount * sizeof(BVHNode)
+        && header.triangleOffset <= size
+        && header.triangleCount <= (size - header.triangleOffset) / sizeof(Triangle);
+    if (!valid) {
+        fprintf(stderr, "Not a bvh file from this build: %s\n", path);
+        close();
+        return false;
+    }
+
+    const char* bytes = (const char*) data;
+    nodes = {(const BVHNode*) (bytes + header.nodeOffset), (size_t) header.nodeCount};
+    triangles = {(const Triangle*) (bytes + header.triangleOffset), (size_t) header.triangleCount};
+    return true;
+}
+
+void MappedBVH::close()
+{
+    if (data)
+        munmap(data, size);
+    data = nullptr;
+    size = 0;
+    nodes = {};
+    triangles = {};
+}
+
+#else
+
+bool MappedBVH::open(const char* path)
+{
+    fprintf(stderr, "Mapping bvh files is only supported on POSIX systems: %s\n", path);
+    return false;
+}
+
+void MappedBVH::close()
+{
+}
+
+#endif
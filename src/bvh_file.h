@@ -0,0 +1,29 @@
+#pragma once
+
+#include "bvh.h"
+
+#include <span>
+#include <string>
+
+// a built bvh on disk: a header, then the nodes and the triangles exactly as they are in memory, each
+// starting on a page boundary so the file can be mapped and traced without copying. only readable by the
+// same build on the same kind of machine, it is a cache, not an interchange format
+bool saveBVHFile(const char* path, std::span<const BVHNode> nodes, std::span<const Triangle> triangles);
+
+// read only mapping of a file from saveBVHFile. every process mapping the same file shares its pages
+struct MappedBVH {
+    std::span<const BVHNode> nodes;
+    std::span<const Triangle> triangles;
+
+    MappedBVH() = default;
+    MappedBVH(const MappedBVH&) = delete;
+    MappedBVH& operator=(const MappedBVH&) = delete;
+    ~MappedBVH() { close(); }
+
+    bool open(const char* path);
+    void close();
+
+private:
+    void* data = nullptr;
+    size_t size = 0;
+};
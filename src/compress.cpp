@@ -0,0 +1,164 @@
+#include "compress.h"
+
+#include "profiling.h"
+
+#include <float.h>
+#include <math.h>
+
+#include <algorithm>
+
+namespace {
+
+void fitLeafBounds(std::vector<BVHNode> & nodes, const std::vector<Triangle> & triangles, int root)
+{
+    // preorder, walked backwards so children are always done before their parent
+    std::vector<int> order;
+    std::vector<int> todo = {root};
+    while (!todo.empty()) {
+        int idx = todo.back();
+        todo.pop_back();
+        order.push_back(idx);
+        if (nodes[idx].left != -1)
+            todo.push_back(nodes[idx].left);
+        if (nodes[idx].right != -1)
+            todo.push_back(nodes[idx].right);
+    }
+
+    for (auto it = order.rbegin(); it != order.rend(); ++it) {
+        BVHNode & node = nodes[*it];
+        float bmin[3] = {INFINITY, INFINITY, INFINITY};
+        float bmax[3] = {-INFINITY, -INFINITY, -INFINITY};
+        auto grow = [&](const float* p) {
+            for (int a = 0; a < 3; a++) {
+                bmin[a] = std::min(bmin[a], p[a]);
+                bmax[a] = std::max(bmax[a], p[a]);
+            }
+        };
+
+        if (node.left == -1 && node.right == -1) {
+            for (int i = node.firstTri; i < node.firstTri + node.triCount; i++) {
+                grow(triangles[i].v0);
+                grow(triangles[i].v1);
+                grow(triangles[i].v2);
+            }
+        } else {
+            for (int child : {node.left, node.right}) {
+                if (child == -1)
+                    continue;
+                grow(nodes[child].boundsMin);
+                grow(nodes[child].boundsMax);
+            }
+        }
+        // an empty leaf keeps whatever box it had
+        if (bmin[0] > bmax[0])
+            continue;
+        for (int a = 0; a < 3; a++) {
+            node.boundsMin[a] = bmin[a];
+            node.boundsMax[a] = bmax[a];
+        }
+    }
+}
+
+uint32_t quantize(float v, float bmin, float scale)
+{
+    if (scale <= 0.0f)
+        return 0;
+    double q = floor(((double) v - bmin) / scale + 0.5);
+    return (uint32_t) std::clamp(q, 0.0, (double) QUANTIZED_MAX);
+}
+
+}
+
+bool packTriangles(std::vector<BVHNode> & nodes, const std::vector<Triangle> & triangles, int root,
+                   std::vector<PackedTriangle> & packed, float & maxError)
+{
+    ScopedTimer timer("triangle packing");
+
+    fitLeafBounds(nodes, triangles, root);
+
+    packed.assign(triangles.size(), PackedTriangle{});
+    maxError = 0.0f;
+    bool withinBound = true;
+
+    std::vector<int> todo = {root};
+    while (!todo.empty()) {
+        const BVHNode & leaf = nodes[todo.back()];
+        todo.pop_back();
+        if (leaf.left != -1 || leaf.right != -1) {
+            if (leaf.left != -1)
+                todo.push_back(leaf.left);
+            if (leaf.right != -1)
+                todo.push_back(leaf.right);
+            continue;
+        }
+
+        float scale[3], bound[3];
+        for (int a = 0; a < 3; a++) {
+            scale[a] = (leaf.boundsMax[a] - leaf.boundsMin[a]) * (1.0f / QUANTIZED_MAX);
+            float magnitude = std::max(fabsf(leaf.boundsMin[a]), fabsf(leaf.boundsMax[a]));
+            bound[a] = (leaf.boundsMax[a] - leaf.boundsMin[a]) / (2.0f * QUANTIZED_MAX) + 4.0f * FLT_EPSILON * magnitude;
+        }
+
+        for (int i = leaf.firstTri; i < leaf.firstTri + leaf.triCount; i++) {
+            const Triangle & tri = triangles[i];
+            const float* v[3] = {tri.v0, tri.v1, tri.v2};
+            PackedTriangle & p = packed[i];
+            for (int k = 0; k < 9; k++) {
+                int axis = k % 3;
+                uint32_t q = quantize(v[k / 3][axis], leaf.boundsMin[axis], scale[axis]);
+                p.q[k >> 1] |= q << ((k & 1) * 16);
+            }
+            p.id = triangleId(tri);
+
+            // check with the decoder the kernels use, not the math above
+            float d[3][3];
+            decodeTriangle(leaf, p, d[0], d[1], d[2]);
+            for (int k = 0; k < 9; k++) {
+                int axis = k % 3;
+                float error = fabsf(d[k / 3][axis] - v[k / 3][axis]);
+                maxError = std::max(maxError, error);
+                if (!(error <= bound[axis]))
+                    withinBound = false;
+            }
+        }
+    }
+    return withinBound;
+}
+
+void unpackTriangles(const std::vector<BVHNode> & nodes, const std::vector<PackedTriangle> & packed, int root,
+                     std::vector<Triangle> & triangles)
+{
+    triangles.assign(packed.size(), Triangle{});
+    std::vector<int> todo = {root};
+    while (!todo.empty()) {
+        const BVHNode & leaf = nodes[todo.back()];
+        todo.pop_back();
+        if (leaf.left != -1 || leaf.right != -1) {
+            if (leaf.left != -1)
+                todo.push_back(leaf.left);
+            if (leaf.right != -1)
+                todo.push_back(leaf.right);
+            continue;
+        }
+        for (int i = leaf.firstTri; i < leaf.firstTri + leaf.triCount; i++) {
+            Triangle & t = triangles[i];
+            decodeTriangle(leaf, packed[i], t.v0, t.v1, t.v2);
+            setTriangleId(t, packed[i].id);
+
+            // face normal, same as loadMesh
+            float e1[3], e2[3];
+            for (int a = 0; a < 3; a++) {
+                e1[a] = t.v1[a] - t.v0[a];
+                e2[a] = t.v2[a] - t.v0[a];
+            }
+            t.normal[0] = e1[1] * e2[2] - e1[2] * e2[1];
+            t.normal[1] = e1[2] * e2[0] - e1[0] * e2[2];
+            t.normal[2] = e1[0] * e2[1] - e1[1] * e2[0];
+            float len = sqrtf(t.normal[0] * t.normal[0] + t.normal[1] * t.normal[1] + t.normal[2] * t.normal[2]);
+            if (len > 0.0f) {
+                for (int a = 0; a < 3; a++)
+                    t.normal[a] /= len;
+            }
+        }
+    }
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "bvh.h"
+
+#include <stdint.h>
+
+#include <vector>
+
+// a triangle with its vertices stored as 16 bit fixed point inside the bounds of the leaf that holds it,
+// 24 bytes instead of the 64 of a Triangle. the normal is not stored, it is the cross product of the
+// decoded edges like in loadMesh.
+//
+// error bound: per axis, a decoded vertex is at most half a quantization step plus float rounding away
+// from the original, |decoded - original| <= extent / 131070 + 4 * FLT_EPSILON * max(|boundsMin|, |boundsMax|)
+// with extent the leaf size on that axis. loadMesh fits the mesh into [-0.5, 0.5] so this is never more
+// than 8e-6, and leaves a few hundred triangles wide are down at float precision. packTriangles checks
+// every vertex against it.
+//
+// two triangles sharing a vertex in different leaves can each be off by their own bound, so the watertight
+// test is only crack free up to that distance between leaves
+struct PackedTriangle {
+    uint32_t q[5]; // x0 y0 | z0 x1 | y1 z1 | x2 y2 | z2 -, low half first
+    int32_t id;    // source triangle id, same as triangleId
+};
+
+const int QUANTIZED_MAX = 65535;
+
+inline int triangleId(const PackedTriangle & t)
+{
+    return t.id;
+}
+
+inline uint32_t packedComponent(const PackedTriangle & t, int k)
+{
+    return (t.q[k >> 1] >> ((k & 1) * 16)) & 0xffff;
+}
+
+// the shader decodes the same way, keep them in step
+inline void decodeTriangle(const BVHNode & leaf, const PackedTriangle & t, float* v0, float* v1, float* v2)
+{
+    float* v[3] = {v0, v1, v2};
+    for (int axis = 0; axis < 3; axis++) {
+        float scale = (leaf.boundsMax[axis] - leaf.boundsMin[axis]) * (1.0f / QUANTIZED_MAX);
+        for (int i = 0; i < 3; i++)
+            v[i][axis] = leaf.boundsMin[axis] + (float) packedComponent(t, i * 3 + axis) * scale;
+    }
+}
+
+// quantizes every triangle against its leaf. every leaf box is first refit to exactly the triangles it holds
+// and the boxes above refit to match, so the nodes change for every builder: midpoint leaves are boxes of the
+// split, not of their triangles, and the sbvh clips leaf boxes to the part of a split triangle inside them,
+// which is no use as a quantization range. each triangle has to belong to exactly one leaf, which holds for
+// every builder and layout here. returns false if a vertex is past the error bound, maxError is the largest per
+// axis error seen
+bool packTriangles(std::vector<BVHNode> & nodes, const std::vector<Triangle> & triangles, int root,
+                   std::vector<PackedTriangle> & packed, float & maxError);
+
+// decodes the packed triangles back into plain ones, for brute force checks against the same geometry
+void unpackTriangles(const std::vector<BVHNode> & nodes, const std::vector<PackedTriangle> & packed, int root,
+                     std::vector<Triangle> & triangles);
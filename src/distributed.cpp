@@ -0,0 +1,651 @@
+#include "distributed.h"
+
+#include "batch.h"
+#include "bvh_file.h"
+#include "mesh.h"
+#include "parallel.h"
+#include "profiling.h"
+#include "render.h"
+#include "socket_io.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// message types and their payloads, framed as in socket_io.h
+enum MessageType : uint32_t {
+    MSG_HELLO = 1, // coordinator -> worker, HelloMessage
+    MSG_READY,     // worker -> coordinator, bvh mapped, no payload
+    MSG_TILE,      // coordinator -> worker, TileMessage
+    MSG_RESULT,    // worker -> coordinator, ResultMessage then the tile's rgb rows
+    MSG_STOP,      // coordinator -> worker, no payload
+};
+
+struct HelloMessage {
+    int32_t width;
+    int32_t height;
+    char bvhPath[1024];
+};
+
+struct TileMessage {
+    int32_t id;
+    int32_t x0, y0, x1, y1;
+    float mvp[16];
+};
+
+struct ResultMessage {
+    int32_t id;
+    int32_t rays;
+};
+
+// tiles a worker holds at once, one being traced and one waiting so it never sits idle on a round trip
+const int WORKER_QUEUE = 2;
+
+// largest frame side a worker accepts, so a garbled hello can't make it allocate an absurd image
+const int MAX_FRAME_SIDE = 1 << 15;
+
+struct Tile {
+    int frame;
+    int x0, y0, x1, y1;
+    int copies = 0; // workers holding it right now
+    bool done = false;
+};
+
+struct WorkerConnection {
+    int fd = -1;
+    bool ready = false;
+    std::vector<char> inbox;
+    std::deque<int> queued; // tiles sent and not answered yet, oldest first
+    long tilesDone = 0;
+};
+
+struct CoordinatorState {
+    const CoordinatorOptions & options;
+    std::string bvhPath;
+    std::vector<CameraFrame> frames;
+    int listenFd = -1;
+    std::vector<std::unique_ptr<WorkerConnection>> workers; // connection order, dead ones are removed
+    int localRunning = 0;
+    bool remoteOnly = false;
+
+    // the current run
+    std::vector<Tile> tiles;
+    std::deque<int> pending;
+    std::vector<Image> images;
+    std::vector<int> tilesLeft;
+    int workerLimit = 0;
+    bool writeImages = false;
+    long tilesDone = 0;
+    long rays = 0;
+    long stolen = 0;
+    long redispatched = 0;
+    bool writeFailed = false;
+
+    explicit CoordinatorState(const CoordinatorOptions & options) : options(options) {}
+};
+
+void closeWorker(CoordinatorState & state, size_t index, const char* why)
+{
+    WorkerConnection & worker = *state.workers[index];
+    fprintf(stderr, "worker %d %s, %zu tiles go back on the queue\n", (int) index, why, worker.queued.size());
+    for (int id : worker.queued) {
+        Tile & tile = state.tiles[id];
+        tile.copies--;
+        if (!tile.done && tile.copies == 0) {
+            state.pending.push_front(id);
+            state.redispatched++;
+        }
+    }
+    close(worker.fd);
+    state.workers.erase(state.workers.begin() + index);
+}
+
+bool sendTile(CoordinatorState & state, WorkerConnection & worker, int id)
+{
+    Tile & tile = state.tiles[id];
+    TileMessage message;
+    message.id = id;
+    message.x0 = tile.x0;
+    message.y0 = tile.y0;
+    message.x1 = tile.x1;
+    message.y1 = tile.y1;
+    memcpy(message.mvp, state.frames[tile.frame].mvp, sizeof(message.mvp));
+    if (!sendMessage(worker.fd, MSG_TILE, &message, sizeof(message)))
+        return false;
+    tile.copies++;
+    worker.queued.push_back(id);
+    return true;
+}
+
+// a tile another worker is still sitting on, taken from the back of the longest queue since that one is the least
+// likely to have been started. every tile is copied at most once
+int stealTile(CoordinatorState & state, const WorkerConnection & thief)
+{
+    WorkerConnection* victim = nullptr;
+    for (auto & worker : state.workers) {
+        if (worker.get() != &thief && (!victim || worker->queued.size() > victim->queued.size()))
+            victim = worker.get();
+    }
+    if (!victim)
+        return -1;
+    for (auto it = victim->queued.rbegin(); it != victim->queued.rend(); ++it) {
+        const Tile & tile = state.tiles[*it];
+        if (!tile.done && tile.copies == 1 && std::find(thief.queued.begin(), thief.queued.end(), *it) == thief.queued.end())
+            return *it;
+    }
+    return -1;
+}
+
+void dispatch(CoordinatorState & state)
+{
+    for (int w = 0; w < (int) state.workers.size() && w < state.workerLimit; w++) {
+        WorkerConnection & worker = *state.workers[w];
+        while (worker.ready && worker.queued.size() < WORKER_QUEUE) {
+            int id = -1;
+            while (!state.pending.empty() && id == -1) {
+                id = state.pending.front();
+                state.pending.pop_front();
+                if (state.tiles[id].done)
+                    id = -1;
+            }
+            bool steal = id == -1;
+            if (steal)
+                id = stealTile(state, worker);
+            if (id == -1)
+                break;
+            if (!sendTile(state, worker, id)) {
+                if (!steal)
+                    state.pending.push_front(id);
+                closeWorker(state, w, "stopped answering");
+                // the next worker moved into this slot
+                w--;
+                break;
+            }
+            if (steal)
+                state.stolen++;
+        }
+    }
+}
+
+// false if the result is malformed, the worker is dropped and its tiles, this one included, go back on the queue
+bool acceptTile(CoordinatorState & state, WorkerConnection & worker, const char* payload, size_t size)
+{
+    ResultMessage result;
+    if (size < sizeof(result))
+        return false;
+    memcpy(&result, payload, sizeof(result));
+    if (result.id < 0 || result.id >= (int) state.tiles.size())
+        return false;
+
+    auto queued = std::find(worker.queued.begin(), worker.queued.end(), result.id);
+    if (queued == worker.queued.end())
+        return true;
+    Tile & tile = state.tiles[result.id];
+    // checked while the tile is still queued on this worker, so closing the worker puts it back
+    size_t rowBytes = (size_t) (tile.x1 - tile.x0) * 3;
+    if (size != sizeof(result) + rowBytes * (tile.y1 - tile.y0))
+        return false;
+
+    worker.queued.erase(queued);
+    worker.tilesDone++;
+    tile.copies--;
+    // the slower copy of a stolen tile
+    if (tile.done)
+        return true;
+
+    Image & image = state.images[tile.frame];
+    if (image.pixels.empty()) {
+        image.width = state.options.width;
+        image.height = state.options.height;
+        image.pixels.resize((size_t) image.width * image.height * 3);
+    }
+    const char* rows = payload + sizeof(result);
+    for (int y = tile.y0; y < tile.y1; y++)
+        memcpy(&image.pixels[3 * ((size_t) y * image.width + tile.x0)], rows + rowBytes * (y - tile.y0), rowBytes);
+
+    tile.done = true;
+    state.tilesDone++;
+    state.rays += result.rays;
+    if (--state.tilesLeft[tile.frame] == 0) {
+        if (state.writeImages) {
+            char path[1024];
+            snprintf(path, sizeof(path), "%s/%s_%04d.ppm", state.options.outDir.c_str(),
+                     meshName(state.bvhPath.c_str()).c_str(), tile.frame);
+            if (!writePPM(path, image))
+                state.writeFailed = true;
+        }
+        std::vector<unsigned char>().swap(image.pixels);
+    }
+    return true;
+}
+
+// reads what the socket has and handles every complete message. false once the worker is gone or sent a bad message
+bool readWorker(CoordinatorState & state, WorkerConnection & worker)
+{
+    // the largest result is one full tile, a header announcing more (or any other message) is rejected before
+    // its payload is buffered
+    const CoordinatorOptions & options = state.options;
+    const int tileSize = std::max(1, options.tileSize);
+    const size_t maxResult = sizeof(ResultMessage) + (size_t) std::min(tileSize, options.width) * std::min(tileSize, options.height) * 3;
+
+    // no more than one whole message is read ahead, poll comes back for the rest
+    char buffer[1 << 16];
+    while (worker.inbox.size() < sizeof(MessageHeader) + maxResult) {
+        ssize_t got = recv(worker.fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (got > 0) {
+            worker.inbox.insert(worker.inbox.end(), buffer, buffer + got);
+            continue;
+        }
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        return false;
+    }
+
+    size_t offset = 0;
+    while (worker.inbox.size() - offset >= sizeof(MessageHeader)) {
+        MessageHeader header;
+        memcpy(&header, worker.inbox.data() + offset, sizeof(header));
+        bool valid = (header.type == MSG_READY && header.size == 0) || (header.type == MSG_RESULT && header.size <= maxResult);
+        if (!valid)
+            return false;
+        if (worker.inbox.size() - offset - sizeof(header) < header.size)
+            break;
+        const char* payload = worker.inbox.data() + offset + sizeof(header);
+        if (header.type == MSG_READY)
+            worker.ready = true;
+        else if (header.type == MSG_RESULT && !acceptTile(state, worker, payload, header.size))
+            return false;
+        offset += sizeof(header) + header.size;
+    }
+    worker.inbox.erase(worker.inbox.begin(), worker.inbox.begin() + offset);
+    return true;
+}
+
+void acceptWorker(CoordinatorState & state)
+{
+    int fd = accept(state.listenFd, nullptr, nullptr);
+    if (fd < 0)
+        return;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    HelloMessage hello = {};
+    hello.width = state.options.width;
+    hello.height = state.options.height;
+    snprintf(hello.bvhPath, sizeof(hello.bvhPath), "%s", state.bvhPath.c_str());
+    if (!sendMessage(fd, MSG_HELLO, &hello, sizeof(hello))) {
+        close(fd);
+        return;
+    }
+
+    auto worker = std::make_unique<WorkerConnection>();
+    worker->fd = fd;
+    state.workers.push_back(std::move(worker));
+}
+
+// local workers that exited. their sockets close too, which is what puts their tiles back
+void reapWorkers(CoordinatorState & state)
+{
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        state.localRunning--;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            fprintf(stderr, "local worker %d exited with status %d\n", (int) pid, WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+    }
+}
+
+bool pollOnce(CoordinatorState & state, int timeoutMs)
+{
+    std::vector<pollfd> fds;
+    fds.push_back({state.listenFd, POLLIN, 0});
+    for (auto & worker : state.workers)
+        fds.push_back({worker->fd, POLLIN, 0});
+    if (poll(fds.data(), fds.size(), timeoutMs) < 0 && errno != EINTR)
+        return false;
+
+    // workers is only appended to by acceptWorker, so the indices still match the pollfds here
+    for (size_t i = fds.size() - 1; i >= 1; i--) {
+        if (fds[i].revents && !readWorker(state, *state.workers[i - 1]))
+            closeWorker(state, i - 1, "disconnected or sent a bad message");
+    }
+    if (fds[0].revents & POLLIN)
+        acceptWorker(state);
+    reapWorkers(state);
+    return true;
+}
+
+// renders every frame once with the first workerLimit workers
+bool renderJob(CoordinatorState & state, int workerLimit, bool writeImages, double & seconds)
+{
+    const CoordinatorOptions & options = state.options;
+    const int tileSize = std::max(1, options.tileSize);
+    const int tilesX = (options.width + tileSize - 1) / tileSize;
+    const int tilesY = (options.height + tileSize - 1) / tileSize;
+
+    state.tiles.clear();
+    state.pending.clear();
+    for (int f = 0; f < (int) state.frames.size(); f++) {
+        for (int t = 0; t < tilesX * tilesY; t++) {
+            Tile tile;
+            tile.frame = f;
+            tile.x0 = (t % tilesX) * tileSize;
+            tile.y0 = (t / tilesX) * tileSize;
+            tile.x1 = std::min(tile.x0 + tileSize, options.width);
+            tile.y1 = std::min(tile.y0 + tileSize, options.height);
+            state.pending.push_back(state.tiles.size());
+            state.tiles.push_back(tile);
+        }
+    }
+    state.images.assign(state.frames.size(), Image());
+    state.tilesLeft.assign(state.frames.size(), tilesX * tilesY);
+    state.workerLimit = workerLimit;
+    state.writeImages = writeImages;
+    state.tilesDone = 0;
+    state.rays = 0;
+    state.stolen = 0;
+    state.redispatched = 0;
+    for (auto & worker : state.workers)
+        worker->tilesDone = 0;
+
+    double start = nowMs();
+    while (state.tilesDone < (long) state.tiles.size()) {
+        dispatch(state);
+        if (!pollOnce(state, 100))
+            return false;
+        if (!state.remoteOnly && state.localRunning == 0 && state.workers.empty()) {
+            fprintf(stderr, "every worker failed, %ld of %zu tiles done\n", state.tilesDone, state.tiles.size());
+            return false;
+        }
+    }
+    seconds = (nowMs() - start) / 1000.0;
+
+    // the slower copies of stolen tiles are still out, tile ids start over next run so let them land first
+    auto outstanding = [&]() {
+        return std::any_of(state.workers.begin(), state.workers.end(), [](auto & w) { return !w->queued.empty(); });
+    };
+    while (outstanding()) {
+        if (!pollOnce(state, 100))
+            return false;
+    }
+    return true;
+}
+
+bool startLocalWorker(CoordinatorState & state, int port, int failAfter)
+{
+    char address[64], threads[16], fail[16];
+    snprintf(address, sizeof(address), "127.0.0.1:%d", port);
+    snprintf(threads, sizeof(threads), "%d", state.options.workerThreads);
+    snprintf(fail, sizeof(fail), "%d", failAfter);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return false;
+    }
+    if (pid == 0) {
+        close(state.listenFd);
+        execlp(state.options.executable, state.options.executable, "--worker", address, "--threads", threads,
+               "--worker-fail-after", fail, (char*) nullptr);
+        perror("exec worker");
+        _exit(127);
+    }
+    state.localRunning++;
+    return true;
+}
+
+}
+
+int runCoordinator(const CoordinatorOptions & options)
+{
+    CoordinatorState state(options);
+
+    if (!loadCameraPath(options.cameraPath, state.frames))
+        return EXIT_FAILURE;
+    if (state.frames.empty()) {
+        fprintf(stderr, "the camera path has no frames\n");
+        return EXIT_FAILURE;
+    }
+
+    // build once, every worker maps the result
+    state.bvhPath = options.bvhPath;
+    if (state.bvhPath.empty() && options.mesh)
+        state.bvhPath = options.outDir + "/" + meshName(options.mesh) + ".bvh";
+    if (options.mesh) {
+        std::vector<Triangle> triangles;
+        std::vector<BVHNode> nodes;
+        aiVector3D min, max;
+        if (!loadMesh(options.mesh, triangles, min, max))
+            return EXIT_FAILURE;
+        buildAccelerationStructure(nodes, triangles, min, max, options.build);
+        {
+            ScopedTimer timer("bvh save");
+            if (!saveBVHFile(state.bvhPath.c_str(), nodes, triangles))
+                return EXIT_FAILURE;
+        }
+        printf("%s: %zu triangles, %zu nodes saved to %s\n", options.mesh, triangles.size(), nodes.size(), state.bvhPath.c_str());
+        printStageTimings();
+    } else if (state.bvhPath.empty()) {
+        fprintf(stderr, "the coordinator needs a --mesh to build or a prebuilt --bvh\n");
+        return EXIT_FAILURE;
+    }
+
+    state.listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(state.listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(options.port);
+    socklen_t addrLen = sizeof(addr);
+    if (state.listenFd < 0 || bind(state.listenFd, (sockaddr*) &addr, sizeof(addr)) != 0 || listen(state.listenFd, 64) != 0
+        || getsockname(state.listenFd, (sockaddr*) &addr, &addrLen) != 0) {
+        perror("coordinator socket");
+        return EXIT_FAILURE;
+    }
+    int port = ntohs(addr.sin_port);
+    printf("coordinator listening on port %d, remote workers run mesh_rt --worker <host>:%d\n", port, port);
+
+    int localWorkers = options.workers >= 0 ? options.workers : (int) std::max(1u, std::thread::hardware_concurrency());
+    state.remoteOnly = localWorkers == 0;
+    for (int i = 0; i < localWorkers; i++) {
+        if (!startLocalWorker(state, port, i == 0 ? options.failAfter : 0))
+            break;
+    }
+
+    // wait for the local workers to map the bvh so startup isn't part of the timings
+    auto readyWorkers = [&]() {
+        return (int) std::count_if(state.workers.begin(), state.workers.end(), [](auto & w) { return w->ready; });
+    };
+    while (readyWorkers() < (state.remoteOnly ? 1 : state.localRunning)) {
+        if (!pollOnce(state, 100))
+            return EXIT_FAILURE;
+    }
+    if (!state.remoteOnly && state.workers.empty()) {
+        fprintf(stderr, "no worker started\n");
+        return EXIT_FAILURE;
+    }
+
+    std::vector<int> counts;
+    if (options.scaling) {
+        for (int n = 1; n < (int) state.workers.size(); n *= 2)
+            counts.push_back(n);
+    }
+    counts.push_back(1 << 30);
+
+    int exitCode = EXIT_SUCCESS;
+    double baseline = 0.0;
+    printf("%d frames of %dx%d, %zu workers connected\n", (int) state.frames.size(), options.width, options.height, state.workers.size());
+    printf("%8s %10s %12s %10s %8s %8s %13s\n", "workers", "seconds", "Mrays/s", "speedup", "stolen", "requeued", "tiles/worker");
+    for (size_t run = 0; run < counts.size(); run++) {
+        bool last = run + 1 == counts.size();
+        double seconds = 0.0;
+        if (!renderJob(state, counts[run], last, seconds)) {
+            exitCode = EXIT_FAILURE;
+            break;
+        }
+        int used = std::min(counts[run], (int) state.workers.size());
+        double mrays = state.rays / seconds / 1e6;
+        if (baseline == 0.0)
+            baseline = mrays;
+        long minTiles = state.tiles.size(), maxTiles = 0;
+        for (int w = 0; w < used; w++) {
+            minTiles = std::min(minTiles, state.workers[w]->tilesDone);
+            maxTiles = std::max(maxTiles, state.workers[w]->tilesDone);
+        }
+        printf("%8d %10.3f %12.3f %9.2fx %8ld %8ld %6ld-%-6ld\n", used, seconds, mrays, mrays / baseline,
+               state.stolen, state.redispatched, minTiles, maxTiles);
+    }
+    if (state.writeFailed)
+        exitCode = EXIT_FAILURE;
+
+    for (auto & worker : state.workers) {
+        sendMessage(worker->fd, MSG_STOP, nullptr, 0);
+        close(worker->fd);
+    }
+    state.workers.clear();
+    close(state.listenFd);
+    while (state.localRunning > 0 && waitpid(-1, nullptr, 0) > 0)
+        state.localRunning--;
+    return exitCode;
+}
+
+int runWorker(const WorkerOptions & options)
+{
+    size_t colon = options.address.rfind(':');
+    if (colon == std::string::npos) {
+        fprintf(stderr, "Expected --worker HOST:PORT, got %s\n", options.address.c_str());
+        return EXIT_FAILURE;
+    }
+    std::string host = options.address.substr(0, colon);
+    std::string port = options.address.substr(colon + 1);
+
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* found = nullptr;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &found) != 0 || !found) {
+        fprintf(stderr, "Failed to resolve coordinator %s\n", options.address.c_str());
+        return EXIT_FAILURE;
+    }
+    int fd = -1;
+    for (addrinfo* a = found; a && fd < 0; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(found);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to connect to coordinator %s\n", options.address.c_str());
+        return EXIT_FAILURE;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    MessageHeader header;
+    HelloMessage hello;
+    if (!recvAll(fd, &header, sizeof(header)) || header.type != MSG_HELLO || header.size != sizeof(hello) || !recvAll(fd, &hello, sizeof(hello))) {
+        fprintf(stderr, "coordinator did not say hello\n");
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    hello.bvhPath[sizeof(hello.bvhPath) - 1] = '\0';
+    if (hello.width <= 0 || hello.height <= 0 || hello.width > MAX_FRAME_SIDE || hello.height > MAX_FRAME_SIDE) {
+        fprintf(stderr, "coordinator sent a %d x %d frame\n", (int) hello.width, (int) hello.height);
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    MappedBVH bvh;
+    if (!bvh.open(options.bvhPath ? options.bvhPath : hello.bvhPath)) {
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    if (!sendMessage(fd, MSG_READY, nullptr, 0)) {
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    // renderTile works in frame coordinates, so keep a frame sized image and copy the tile out of it
+    Image image;
+    image.width = hello.width;
+    image.height = hello.height;
+    image.pixels.resize((size_t) image.width * image.height * 3);
+    std::vector<char> result;
+
+    long tiles = 0;
+    for (;;) {
+        if (!recvAll(fd, &header, sizeof(header)) || header.type == MSG_STOP)
+            break;
+        TileMessage tile;
+        if (header.type != MSG_TILE || header.size != sizeof(tile) || !recvAll(fd, &tile, sizeof(tile)))
+            break;
+        if (tile.x0 < 0 || tile.y0 < 0 || tile.x1 > image.width || tile.y1 > image.height || tile.x1 <= tile.x0 || tile.y1 <= tile.y0) {
+            fprintf(stderr, "coordinator sent tile %d outside the frame: (%d, %d) to (%d, %d)\n", (int) tile.id, (int) tile.x0,
+                    (int) tile.y0, (int) tile.x1, (int) tile.y1);
+            close(fd);
+            return EXIT_FAILURE;
+        }
+
+        mat4x4 mvp;
+        memcpy(mvp, tile.mvp, sizeof(mvp));
+        parallelFor(tile.y1 - tile.y0, [&](int row) {
+            renderTile(bvh.nodes, bvh.triangles, mvp, image, tile.x0, tile.y0 + row, tile.x1, tile.y0 + row + 1);
+        }, options.threads);
+
+        ResultMessage message = {tile.id, (tile.x1 - tile.x0) * (tile.y1 - tile.y0)};
+        size_t rowBytes = (size_t) (tile.x1 - tile.x0) * 3;
+        result.resize(rowBytes * (tile.y1 - tile.y0));
+        for (int y = tile.y0; y < tile.y1; y++)
+            memcpy(&result[rowBytes * (y - tile.y0)], &image.pixels[3 * ((size_t) y * image.width + tile.x0)], rowBytes);
+        if (!sendMessage(fd, MSG_RESULT, &message, sizeof(message), result.data(), result.size()))
+            break;
+
+        // simulated crash for testing the re-dispatch, no goodbye and no cleanup
+        if (options.failAfter > 0 && ++tiles == options.failAfter)
+            _exit(3);
+    }
+    close(fd);
+    return EXIT_SUCCESS;
+}
+
+#else
+
+int runCoordinator(const CoordinatorOptions &)
+{
+    fprintf(stderr, "Distributed rendering is only supported on POSIX systems\n");
+    return EXIT_FAILURE;
+}
+
+int runWorker(const WorkerOptions &)
+{
+    fprintf(stderr, "Distributed rendering is only supported on POSIX systems\n");
+    return EXIT_FAILURE;
+}
+
+#endif
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "bvh.h"
+
+#include <string>
+
+struct CoordinatorOptions {
+    const char* executable = nullptr; // argv[0], started again with --worker for the local workers
+    const char* cameraPath = nullptr;
+    const char* mesh = nullptr;       // built once and saved to bvhPath. without one, bvhPath must already exist
+    std::string bvhPath;              // defaults to <outDir>/<mesh name>.bvh
+    std::string outDir = ".";
+    int width = 512;
+    int height = 512;
+    int tileSize = 32;
+    int workers = -1;                 // local worker processes, -1 is one per hardware thread, 0 waits for remote ones
+    int workerThreads = 1;
+    int port = 0;                     // 0 picks a free port
+    bool scaling = false;             // render the job with 1, 2, 4 ... workers and report the throughput of each
+    int failAfter = 0;                // testing aid, the first local worker exits without a word after this many tiles
+    BuildSettings build;
+};
+
+// tile distributed batch rendering. the coordinator builds the bvh once, writes it to a file every worker maps
+// read only, and hands out tiles over tcp. workers pull: each keeps a couple of tiles queued and asks for more as
+// results come back, so cheap and expensive tiles even out. once the queue is empty, idle workers are given a
+// second copy of the tiles still queued on the busiest worker and whichever result lands first is kept. a worker
+// that disconnects or dies has its tiles put back at the front of the queue. frames are assembled as their last
+// tile arrives and written to <outDir>/<name>_<frame>.ppm like --batch. returns the process exit code
+int runCoordinator(const CoordinatorOptions & options);
+
+struct WorkerOptions {
+    std::string address;              // host:port of the coordinator
+    const char* bvhPath = nullptr;    // overrides the path the coordinator sends, for a different mount on another node
+    int threads = 1;
+    int failAfter = 0;
+};
+
+// connects to a coordinator and renders tiles until it says stop. returns the process exit code
+int runWorker(const WorkerOptions & options);
@@ -0,0 +1,357 @@
+#include "incremental.h"
+
+#include "parallel.h"
+#include "profiling.h"
+#include "trace.h"
+
+#include <math.h>
+#include <stdio.h>
+
+#include <algorithm>
+
+namespace {
+
+void triangleBounds(const Triangle & t, float* bmin, float* bmax)
+{
+    for (int a = 0; a < 3; a++) {
+        bmin[a] = std::min(t.v0[a], std::min(t.v1[a], t.v2[a]));
+        bmax[a] = std::max(t.v0[a], std::max(t.v1[a], t.v2[a]));
+    }
+}
+
+bool boxContains(const BVHNode & node, const float* p)
+{
+    for (int a = 0; a < 3; a++) {
+        if (p[a] < node.boundsMin[a] || p[a] > node.boundsMax[a])
+            return false;
+    }
+    return true;
+}
+
+// sorted, merged [first, last) ranges
+std::vector<std::pair<int, int>> mergeRanges(std::vector<std::pair<int, int>> ranges)
+{
+    std::sort(ranges.begin(), ranges.end());
+    std::vector<std::pair<int, int>> merged;
+    for (auto range : ranges) {
+        if (!merged.empty() && range.first <= merged.back().second)
+            merged.back().second = std::max(merged.back().second, range.second);
+        else
+            merged.push_back(range);
+    }
+    return merged;
+}
+
+}
+
+IncrementalBVH::IncrementalBVH(std::vector<BVHNode> & bounding_volumes, std::vector<Triangle> & triangles, const BuildSettings & settings)
+    : nodes(bounding_volumes), triangles(triangles), settings(settings)
+{
+    indexLeaves();
+}
+
+void IncrementalBVH::indexLeaves()
+{
+    leafOf.assign(triangles.size(), -1);
+    isDirty.assign(triangles.size(), false);
+    std::vector<int> todo = {0};
+    while (!todo.empty()) {
+        int idx = todo.back();
+        todo.pop_back();
+        const BVHNode & node = nodes[idx];
+        if (node.left != -1 || node.right != -1) {
+            todo.push_back(node.left);
+            todo.push_back(node.right);
+            continue;
+        }
+        for (int i = node.firstTri; i < node.firstTri + node.triCount; i++)
+            leafOf[i] = idx;
+    }
+}
+
+void IncrementalBVH::markDirty(int index)
+{
+    if (!isDirty[index]) {
+        isDirty[index] = true;
+        dirty.push_back(index);
+    }
+}
+
+void IncrementalBVH::rebuildSubtree(int root, BVHUpdate & result, std::vector<int> & touchedNodes)
+{
+    const BVHNode old = nodes[root];
+    int depth = 0;
+    for (int p = old.parent; p != -1; p = nodes[p].parent)
+        depth++;
+
+    // the old nodes below the root are done with. turn them into far away empty leaves and free their slots
+    std::vector<int> todo;
+    if (old.left != -1)
+        todo.push_back(old.left);
+    if (old.right != -1)
+        todo.push_back(old.right);
+    while (!todo.empty()) {
+        int idx = todo.back();
+        todo.pop_back();
+        if (nodes[idx].left != -1)
+            todo.push_back(nodes[idx].left);
+        if (nodes[idx].right != -1)
+            todo.push_back(nodes[idx].right);
+
+        BVHNode & freed = nodes[idx];
+        freed = BVHNode{};
+        for (int a = 0; a < 3; a++)
+            freed.boundsMin[a] = freed.boundsMax[a] = 1e30f;
+        freed.left = freed.right = -1;
+        freed.parent = freed.escape = -1;
+        freeList.push_back(idx);
+        touchedNodes.push_back(idx);
+    }
+
+    // the old box grown by whatever the edited triangles now stick out of it
+    aiVector3D min(old.boundsMin[0], old.boundsMin[1], old.boundsMin[2]);
+    aiVector3D max(old.boundsMax[0], old.boundsMax[1], old.boundsMax[2]);
+    for (int i = old.firstTri; i < old.firstTri + old.triCount; i++) {
+        float tmin[3], tmax[3];
+        triangleBounds(triangles[i], tmin, tmax);
+        for (int a = 0; a < 3; a++) {
+            min[a] = std::min(min[a], tmin[a]);
+            max[a] = std::max(max[a], tmax[a]);
+        }
+    }
+
+    std::vector<BVHNode> built;
+    buildBVHRange(built, triangles, old.firstTri, old.triCount, min, max, depth);
+
+    // most recently freed slots first, which are this subtree's own
+    std::vector<int> slot(built.size());
+    slot[0] = root;
+    for (size_t i = 1; i < built.size(); i++) {
+        if (!freeList.empty()) {
+            slot[i] = freeList.back();
+            freeList.pop_back();
+        } else {
+            slot[i] = nodes.size();
+            nodes.push_back(BVHNode{});
+        }
+    }
+    for (size_t i = 0; i < built.size(); i++) {
+        BVHNode node = built[i];
+        if (node.left != -1)
+            node.left = slot[node.left];
+        if (node.right != -1)
+            node.right = slot[node.right];
+        nodes[slot[i]] = node;
+        touchedNodes.push_back(slot[i]);
+        if (node.left == -1 && node.right == -1) {
+            for (int t = node.firstTri; t < node.firstTri + node.triCount; t++)
+                leafOf[t] = slot[i];
+        }
+    }
+    nodes[root].parent = old.parent;
+    nodes[root].escape = old.escape;
+    linkBVHSubtree(nodes, root);
+
+    // grow the ancestors until one already holds the new box, they are small moves by construction
+    for (int child = root, p = old.parent; p != -1; child = p, p = nodes[p].parent) {
+        bool grew = false;
+        for (int a = 0; a < 3; a++) {
+            if (nodes[child].boundsMin[a] < nodes[p].boundsMin[a]) {
+                nodes[p].boundsMin[a] = nodes[child].boundsMin[a];
+                grew = true;
+            }
+            if (nodes[child].boundsMax[a] > nodes[p].boundsMax[a]) {
+                nodes[p].boundsMax[a] = nodes[child].boundsMax[a];
+                grew = true;
+            }
+        }
+        if (!grew)
+            break;
+        touchedNodes.push_back(p);
+    }
+
+    result.subtrees++;
+    result.nodesBuilt += built.size();
+    result.trianglesRebuilt += old.triCount;
+    result.triangleRanges.push_back({old.firstTri, old.firstTri + old.triCount});
+}
+
+BVHUpdate IncrementalBVH::update()
+{
+    BVHUpdate result;
+    if (dirty.empty())
+        return result;
+
+    // the smallest subtree whose box still holds each changed triangle's centroid, which is where the midpoint
+    // builder would have put it. the rest of the triangle can stick out, the boxes above grow to cover it
+    std::vector<int> roots;
+    bool contiguous = nodes[0].firstTri != -1;
+    for (int t : dirty) {
+        const Triangle & tri = triangles[t];
+        float centroid[3];
+        for (int a = 0; a < 3; a++)
+            centroid[a] = (tri.v0[a] + tri.v1[a] + tri.v2[a]) / 3.0f;
+        int idx = leafOf[t];
+        while (idx != 0 && !boxContains(nodes[idx], centroid))
+            idx = nodes[idx].parent;
+        roots.push_back(idx);
+    }
+    std::sort(roots.begin(), roots.end());
+    roots.erase(std::unique(roots.begin(), roots.end()), roots.end());
+
+    for (int t : dirty)
+        isDirty[t] = false;
+    dirty.clear();
+
+    if (!contiguous || std::binary_search(roots.begin(), roots.end(), 0)) {
+        // nothing smaller than the whole tree will do, and a full build also brings back the node layout
+        aiVector3D min(1e30f, 1e30f, 1e30f), max(-1e30f, -1e30f, -1e30f);
+        for (const Triangle & tri : triangles) {
+            float tmin[3], tmax[3];
+            triangleBounds(tri, tmin, tmax);
+            for (int a = 0; a < 3; a++) {
+                min[a] = std::min(min[a], tmin[a]);
+                max[a] = std::max(max[a], tmax[a]);
+            }
+        }
+        buildAccelerationStructure(nodes, triangles, min, max, settings);
+        freeList.clear();
+        indexLeaves();
+        result.fullRebuild = true;
+        result.nodesGrew = true;
+        result.subtrees = 1;
+        result.nodesBuilt = nodes.size();
+        result.trianglesRebuilt = triangles.size();
+        result.nodeRanges.push_back({0, (int) nodes.size()});
+        result.triangleRanges.push_back({0, (int) triangles.size()});
+        return result;
+    }
+
+    // a root inside another root's subtree is rebuilt along with it
+    std::vector<int> outer;
+    for (int r : roots) {
+        bool nested = false;
+        for (int p = nodes[r].parent; p != -1 && !nested; p = nodes[p].parent)
+            nested = std::binary_search(roots.begin(), roots.end(), p);
+        if (!nested)
+            outer.push_back(r);
+    }
+
+    size_t nodesBefore = nodes.size();
+    std::vector<int> touched;
+    for (int r : outer)
+        rebuildSubtree(r, result, touched);
+
+    std::vector<std::pair<int, int>> nodeRanges;
+    for (int idx : touched)
+        nodeRanges.push_back({idx, idx + 1});
+    result.nodeRanges = mergeRanges(nodeRanges);
+    result.triangleRanges = mergeRanges(result.triangleRanges);
+    result.nodesGrew = nodes.size() > nodesBefore;
+    return result;
+}
+
+std::vector<int> pushTriangles(std::vector<Triangle> & triangles, const float* center, int count, float distance)
+{
+    count = std::min(count, (int) triangles.size());
+    std::vector<std::pair<float, int>> byDistance(triangles.size());
+    for (size_t i = 0; i < triangles.size(); i++) {
+        const Triangle & t = triangles[i];
+        float d2 = 0.0f;
+        for (int a = 0; a < 3; a++) {
+            float c = (t.v0[a] + t.v1[a] + t.v2[a]) / 3.0f - center[a];
+            d2 += c * c;
+        }
+        byDistance[i] = {d2, (int) i};
+    }
+    std::nth_element(byDistance.begin(), byDistance.begin() + count, byDistance.end());
+
+    std::vector<int> moved;
+    for (int k = 0; k < count; k++) {
+        Triangle & t = triangles[byDistance[k].second];
+        for (int a = 0; a < 3; a++) {
+            float offset = t.normal[a] * distance;
+            t.v0[a] += offset;
+            t.v1[a] += offset;
+            t.v2[a] += offset;
+        }
+        moved.push_back(byDistance[k].second);
+    }
+    return moved;
+}
+
+bool pickEdit(std::span<const BVHNode> nodes, std::span<const Triangle> triangles, mat4x4 const mvp, float* center, float & distance)
+{
+    vec3 ro, rd;
+    primaryRay(mvp, 0.5f, 0.5f, ro, rd);
+    HitInfo middle = closestHitFromBVHStackless(nodes, triangles, ro, rd);
+    if (middle.tri == -1)
+        return false;
+
+    // push into the mesh rather than out of it so the edit doesn't just grow the root box
+    const Triangle & t = triangles[middle.tri];
+    float inward = 0.0f;
+    for (int a = 0; a < 3; a++) {
+        center[a] = (t.v0[a] + t.v1[a] + t.v2[a]) / 3.0f;
+        inward += t.normal[a] * ((nodes[0].boundsMin[a] + nodes[0].boundsMax[a]) * 0.5f - center[a]);
+    }
+    distance = inward < 0.0f ? -fabsf(distance) : fabsf(distance);
+    return true;
+}
+
+void runEditBenchmark(std::vector<BVHNode> & nodes, std::vector<Triangle> & triangles, const BuildSettings & settings)
+{
+    const int CHECK_SIZE = 32;
+    mat4x4 mvp;
+    viewMatrix(mvp, 0.0f, 0.0f);
+
+    // edit around whatever the middle of the screen shows so the check rays cross the edit
+    float center[3] = {0.0f, 0.0f, 0.0f};
+    float distance = 0.005f;
+    pickEdit(nodes, triangles, mvp, center, distance);
+
+    IncrementalBVH incremental(nodes, triangles, settings);
+
+    printf("%10s %9s %12s %12s %12s %14s %12s\n", "triangles", "subtrees", "nodes built", "update ms", "full ms", "upload bytes", "mismatches");
+    for (int count = 16; count <= (int) triangles.size(); count *= 8) {
+        for (int t : pushTriangles(triangles, center, count, distance))
+            incremental.markDirty(t);
+
+        double start = nowMs();
+        BVHUpdate result = incremental.update();
+        double updateMs = nowMs() - start;
+
+        size_t uploadBytes = 0;
+        for (auto range : result.nodeRanges)
+            uploadBytes += (range.second - range.first) * sizeof(BVHNode);
+        for (auto range : result.triangleRanges)
+            uploadBytes += (range.second - range.first) * sizeof(Triangle);
+
+        std::vector<Triangle> fullTriangles = triangles;
+        std::vector<BVHNode> fullNodes;
+        aiVector3D min(nodes[0].boundsMin[0], nodes[0].boundsMin[1], nodes[0].boundsMin[2]);
+        aiVector3D max(nodes[0].boundsMax[0], nodes[0].boundsMax[1], nodes[0].boundsMax[2]);
+        start = nowMs();
+        buildAccelerationStructure(fullNodes, fullTriangles, min, max, settings);
+        double fullMs = nowMs() - start;
+
+        std::vector<int> rowMismatches(CHECK_SIZE, 0);
+        parallelFor(CHECK_SIZE, [&](int y) {
+            for (int x = 0; x < CHECK_SIZE; x++) {
+                vec3 ro, rd;
+                primaryRay(mvp, (x + 0.5f) / CHECK_SIZE, (y + 0.5f) / CHECK_SIZE, ro, rd);
+                HitInfo got = closestHitFromBVHStackless(nodes, triangles, ro, rd);
+                HitInfo want = closestHitBruteForce(triangles, ro, rd);
+                if (got.tri != want.tri && !(got.tri != -1 && want.tri != -1 && got.t == want.t))
+                    rowMismatches[y]++;
+            }
+        });
+        int mismatches = 0;
+        for (int m : rowMismatches)
+            mismatches += m;
+
+        printf("%10d %9d %12d %12.3f %12.3f %14zu %12d%s\n", count, result.subtrees, result.nodesBuilt, updateMs, fullMs,
+               uploadBytes, mismatches, result.fullRebuild ? "  (full rebuild)" : "");
+    }
+    printf("%zu nodes, %zu of them free\n", nodes.size(), incremental.freeNodes());
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "bvh.h"
+
+#include "linmath.h"
+
+#include <span>
+#include <utility>
+#include <vector>
+
+// what an update touched, as [first, last) index ranges, for glBufferSubData
+struct BVHUpdate {
+    std::vector<std::pair<int, int>> nodeRanges;
+    std::vector<std::pair<int, int>> triangleRanges;
+    bool nodesGrew = false; // bounding_volumes got longer than before the update
+    bool fullRebuild = false;
+    int subtrees = 0;       // subtrees rebuilt
+    int nodesBuilt = 0;
+    int trianglesRebuilt = 0;
+};
+
+// keeps a bvh in step with edits to some of its triangles by rebuilding only the subtrees they live in.
+// for each changed triangle it walks up from its leaf to the first node whose box still holds the triangle's
+// new centroid, so moving a triangle a little rebuilds a small subtree and moving it across the mesh rebuilds
+// a big one. boxes above a rebuilt subtree only grow by what its triangles now stick out.
+// subtrees are rebuilt with the midpoint builder in place: the subtree root keeps its slot (so its parent and
+// escape link stay right), the triangles are partitioned inside the subtree's own range, and the old nodes go
+// to a free list that new nodes take slots from before the array grows. freed slots are turned into empty
+// leaves far away, which the traversals can't reach and the box view can't hit.
+//
+// needs every node to cover a contiguous triangle range, which is true for both builders but not after
+// layoutBVH with reorderTriangles, where update falls back to a full rebuild. new nodes land wherever a slot is
+// free, so the layout from layoutBVH slowly decays as edits pile up.
+//
+// only for the midpoint builder. the sbvh leaves several copies of a split triangle in the array, so an edit
+// by index can move one copy and leave the others behind, and a full rebuild would split the copies again and
+// grow the array on every fallback. the viewer and --bench-edit refuse edits on sbvh meshes rather than keep
+// the source triangles alongside
+class IncrementalBVH {
+public:
+    IncrementalBVH(std::vector<BVHNode> & bounding_volumes, std::vector<Triangle> & triangles, const BuildSettings & settings);
+
+    // call after changing triangles[index]
+    void markDirty(int index);
+
+    // rebuilds whatever the dirty triangles need, relinks the new subtrees and returns the ranges that changed
+    BVHUpdate update();
+
+    size_t freeNodes() const { return freeList.size(); }
+
+private:
+    void indexLeaves();
+    void rebuildSubtree(int root, BVHUpdate & result, std::vector<int> & touchedNodes);
+
+    std::vector<BVHNode> & nodes;
+    std::vector<Triangle> & triangles;
+    BuildSettings settings;
+    std::vector<int> leafOf;   // leaf holding each triangle slot
+    std::vector<int> freeList; // node slots no longer in the tree
+    std::vector<int> dirty;
+    std::vector<bool> isDirty;
+};
+
+// moves the count triangles whose centroids are nearest to center along their normals by distance and returns
+// their indices. a stand-in for an edit tool in the viewer and the benchmark
+std::vector<int> pushTriangles(std::vector<Triangle> & triangles, const float* center, int count, float distance);
+
+// centers an edit on the triangle under the middle of the screen and flips distance so it pushes into the mesh.
+// false when the middle of the screen misses
+bool pickEdit(std::span<const BVHNode> nodes, std::span<const Triangle> triangles, mat4x4 const mvp, float* center, float & distance);
+
+// update time against a full rebuild for growing edit sizes, with a brute force check after each update
+void runEditBenchmark(std::vector<BVHNode> & nodes, std::vector<Triangle> & triangles, const BuildSettings & settings);
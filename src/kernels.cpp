@@ -0,0 +1,501 @@
+#include "kernels.h"
+
+#include "bench.h"
+#include "profiling.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <array>
+#include <type_traits>
+#include <utility>
+
+namespace {
+
+template <IntersectMode M>
+inline bool boxHit(const Ray& ray, const BVHNode& node)
+{
+    if constexpr (M == IntersectMode::Watertight)
+        return rayAABBIntersectRobust(ray, node.boundsMin, node.boundsMax);
+    else
+        return rayAABBIntersect(ray.origin, ray.dir, node.boundsMin, node.boundsMax);
+}
+
+template <IntersectMode M>
+inline bool triangleHit(const Ray& ray, float const* v0, float const* v1, float const* v2, float& t)
+{
+    if constexpr (M == IntersectMode::Watertight)
+        return rayTriangleIntersectWatertight(ray, v0, v1, v2, t);
+    else
+        return rayTriangleIntersect(ray.origin, ray.dir, v0, v1, v2, t);
+}
+
+template <IntersectMode M, typename Tri>
+inline bool leafTriangleHit(const Ray& ray, const BVHNode& leaf, std::span<const Tri> triangles, int i, float& t)
+{
+    if constexpr (std::is_same_v<Tri, PackedTriangle>) {
+        vec3 v0, v1, v2;
+        decodeTriangle(leaf, triangles[i], v0, v1, v2);
+        return triangleHit<M>(ray, v0, v1, v2, t);
+    } else {
+        const Triangle& tri = triangles[i];
+        return triangleHit<M>(ray, tri.v0, tri.v1, tri.v2, t);
+    }
+}
+
+// true when an any hit query found something and the walk can stop
+template <IntersectMode M, Query Q, bool Counts, typename Tri>
+inline bool intersectLeaf(const BVHNode& node, std::span<const Tri> triangles, const Ray& ray, HitInfo& hit, TraversalCounts* counts)
+{
+    for (int i = 0; i < node.triCount; i++) {
+        if constexpr (Counts)
+            counts->triangles++;
+        float t;
+        if (leafTriangleHit<M>(ray, node, triangles, node.firstTri + i, t) && t < hit.t) {
+            hit.t = t;
+            hit.tri = node.firstTri + i;
+            if constexpr (Q == Query::AnyHit)
+                return true;
+        }
+    }
+    return false;
+}
+
+}
+
+const char* traversalName(Traversal traversal)
+{
+    return traversal == Traversal::Stack ? "stack" : "stackless";
+}
+
+const char* queryName(Query query)
+{
+    return query == Query::AnyHit ? "any" : "closest";
+}
+
+std::string kernelName(const KernelConfig& config)
+{
+    std::string name = std::string(traversalName(config.traversal)) + " " + intersectModeName(config.intersect) + " " + queryName(config.query);
+    if (config.counts)
+        name += "+counts";
+    return name;
+}
+
+template <Traversal T, IntersectMode M, Query Q, bool Counts, typename Tri>
+HitInfo traceKernel(std::span<const BVHNode> nodes, std::span<const Tri> triangles, const Ray& ray, float tMax, [[maybe_unused]] TraversalCounts* counts)
+{
+    HitInfo hit;
+    hit.t = tMax;
+
+    if constexpr (T == Traversal::Stack) {
+        const int MAX_STACK_SIZE = 64;
+        int stack[MAX_STACK_SIZE];
+        int stackPtr = 0;
+        stack[stackPtr++] = 0;
+
+        while (stackPtr > 0) {
+            const BVHNode& node = nodes[stack[--stackPtr]];
+            if constexpr (Counts)
+                counts->nodes++;
+
+            if (!boxHit<M>(ray, node))
+                continue;
+
+            if (node.left == -1 && node.right == -1) {
+                if (intersectLeaf<M, Q, Counts>(node, triangles, ray, hit, counts))
+                    break;
+            } else {
+                if (node.left != -1)
+                    stack[stackPtr++] = node.left;
+                if (node.right != -1)
+                    stack[stackPtr++] = node.right;
+                // same as the shader, an overflow loses whatever is left on the stack
+                if (stackPtr >= MAX_STACK_SIZE)
+                    break;
+            }
+        }
+    } else {
+        int nodeIndex = 0;
+        while (nodeIndex != -1) {
+            const BVHNode& node = nodes[nodeIndex];
+            if constexpr (Counts)
+                counts->nodes++;
+
+            if (!boxHit<M>(ray, node)) {
+                nodeIndex = node.escape;
+                continue;
+            }
+
+            if (node.left == -1 && node.right == -1) {
+                if (intersectLeaf<M, Q, Counts>(node, triangles, ray, hit, counts))
+                    break;
+                nodeIndex = node.escape;
+            } else {
+                nodeIndex = node.left;
+            }
+        }
+    }
+    return hit;
+}
+
+#define INSTANTIATE_KERNEL(T, M, Q, COUNTS, TRI)                                                                                \
+    template HitInfo traceKernel<Traversal::T, IntersectMode::M, Query::Q, COUNTS, TRI>(std::span<const BVHNode>, std::span<const TRI>, \
+                                                                                        const Ray&, float, TraversalCounts*);
+#define INSTANTIATE_QUERIES(T, M, TRI)                \
+    INSTANTIATE_KERNEL(T, M, ClosestHit, false, TRI) \
+    INSTANTIATE_KERNEL(T, M, ClosestHit, true, TRI)  \
+    INSTANTIATE_KERNEL(T, M, AnyHit, false, TRI)     \
+    INSTANTIATE_KERNEL(T, M, AnyHit, true, TRI)
+#define INSTANTIATE_KERNELS(TRI)                     \
+    INSTANTIATE_QUERIES(Stack, Fast, TRI)            \
+    INSTANTIATE_QUERIES(Stack, Watertight, TRI)      \
+    INSTANTIATE_QUERIES(Stackless, Fast, TRI)        \
+    INSTANTIATE_QUERIES(Stackless, Watertight, TRI)
+
+INSTANTIATE_KERNELS(Triangle)
+INSTANTIATE_KERNELS(PackedTriangle)
+
+#undef INSTANTIATE_KERNELS
+#undef INSTANTIATE_QUERIES
+#undef INSTANTIATE_KERNEL
+
+namespace {
+
+// one bit per choice, in the order of the enums
+int kernelIndex(const KernelConfig& config)
+{
+    return (int) config.traversal << 3 | (int) config.intersect << 2 | (int) config.query << 1 | (int) config.counts;
+}
+
+template <typename Tri, int I>
+constexpr TraceKernel<Tri> kernelAt()
+{
+    return traceKernel<(Traversal) (I >> 3), (IntersectMode) (I >> 2 & 1), (Query) (I >> 1 & 1), (I & 1) != 0, Tri>;
+}
+
+template <typename Tri, int... I>
+constexpr std::array<TraceKernel<Tri>, sizeof...(I)> kernelTable(std::integer_sequence<int, I...>)
+{
+    return {kernelAt<Tri, I>()...};
+}
+
+}
+
+template <typename Tri>
+TraceKernel<Tri> selectKernel(const KernelConfig& config)
+{
+    static constexpr std::array<TraceKernel<Tri>, 16> kernels = kernelTable<Tri>(std::make_integer_sequence<int, 16>());
+    return kernels[kernelIndex(config)];
+}
+
+template TraceKernel<Triangle> selectKernel<Triangle>(const KernelConfig& config);
+template TraceKernel<PackedTriangle> selectKernel<PackedTriangle>(const KernelConfig& config);
+
+namespace {
+
+// the walk as it was before the kernels, every choice a branch taken per node or per triangle
+template <typename Tri>
+HitInfo runtimeTraversal(std::span<const BVHNode> nodes, std::span<const Tri> triangles, const Ray& ray, float tMax, const KernelConfig& config,
+                         TraversalCounts* counts)
+{
+    const int MAX_STACK_SIZE = 64;
+    const bool watertight = config.intersect == IntersectMode::Watertight;
+    const bool stackless = config.traversal == Traversal::Stackless;
+
+    HitInfo hit;
+    hit.t = tMax;
+    int stack[MAX_STACK_SIZE];
+    int stackPtr = 0;
+    int nodeIndex = 0;
+    while (nodeIndex != -1) {
+        const BVHNode& node = nodes[nodeIndex];
+        if (config.counts)
+            counts->nodes++;
+
+        bool boxHitNode = watertight ? boxHit<IntersectMode::Watertight>(ray, node) : boxHit<IntersectMode::Fast>(ray, node);
+        bool leaf = node.left == -1 && node.right == -1;
+        if (boxHitNode && leaf) {
+            for (int i = 0; i < node.triCount; i++) {
+                if (config.counts)
+                    counts->triangles++;
+                float t;
+                bool triHit = watertight ? leafTriangleHit<IntersectMode::Watertight>(ray, node, triangles, node.firstTri + i, t)
+                                         : leafTriangleHit<IntersectMode::Fast>(ray, node, triangles, node.firstTri + i, t);
+                if (triHit && t < hit.t) {
+                    hit.t = t;
+                    hit.tri = node.firstTri + i;
+                    if (config.query == Query::AnyHit)
+                        return hit;
+                }
+            }
+        }
+
+        if (stackless) {
+            nodeIndex = boxHitNode && !leaf ? node.left : node.escape;
+        } else {
+            if (boxHitNode && !leaf) {
+                if (node.left != -1)
+                    stack[stackPtr++] = node.left;
+                if (node.right != -1)
+                    stack[stackPtr++] = node.right;
+                if (stackPtr >= MAX_STACK_SIZE)
+                    break;
+            }
+            nodeIndex = stackPtr > 0 ? stack[--stackPtr] : -1;
+        }
+    }
+    return hit;
+}
+
+// loops written out by hand for one case each, what the kernels should compile down to
+
+HitInfo handStacklessFastClosest(std::span<const BVHNode> nodes, std::span<const Triangle> triangles, const Ray& ray, float tMax, TraversalCounts*)
+{
+    HitInfo hit;
+    hit.t = tMax;
+    int nodeIndex = 0;
+    while (nodeIndex != -1) {
+        const BVHNode& node = nodes[nodeIndex];
+        if (!rayAABBIntersect(ray.origin, ray.dir, node.boundsMin, node.boundsMax)) {
+            nodeIndex = node.escape;
+        } else if (node.left == -1 && node.right == -1) {
+            for (int i = node.firstTri; i < node.firstTri + node.triCount; i++) {
+                float t;
+                if (rayTriangleIntersect(ray.origin, ray.dir, triangles[i].v0, triangles[i].v1, triangles[i].v2, t) && t < hit.t) {
+                    hit.t = t;
+                    hit.tri = i;
+                }
+            }
+            nodeIndex = node.escape;
+        } else {
+            nodeIndex = node.left;
+        }
+    }
+    return hit;
+}
+
+HitInfo handStackFastClosest(std::span<const BVHNode> nodes, std::span<const Triangle> triangles, const Ray& ray, float tMax, TraversalCounts*)
+{
+    HitInfo hit;
+    hit.t = tMax;
+    int stack[64];
+    int stackPtr = 0;
+    stack[stackPtr++] = 0;
+    while (stackPtr > 0) {
+        const BVHNode& node = nodes[stack[--stackPtr]];
+        if (!rayAABBIntersect(ray.origin, ray.dir, node.boundsMin, node.boundsMax))
+            continue;
+        if (node.left == -1 && node.right == -1) {
+            for (int i = node.firstTri; i < node.firstTri + node.triCount; i++) {
+                float t;
+                if (rayTriangleIntersect(ray.origin, ray.dir, triangles[i].v0, triangles[i].v1, triangles[i].v2, t) && t < hit.t) {
+                    hit.t = t;
+                    hit.tri = i;
+                }
+            }
+        } else {
+            if (node.left != -1)
+                stack[stackPtr++] = node.left;
+            if (node.right != -1)
+                stack[stackPtr++] = node.right;
+            if (stackPtr >= 64)
+                break;
+        }
+    }
+    return hit;
+}
+
+HitInfo handStacklessFastAny(std::span<const BVHNode> nodes, std::span<const Triangle> triangles, const Ray& ray, float tMax, TraversalCounts*)
+{
+    HitInfo hit;
+    hit.t = tMax;
+    int nodeIndex = 0;
+    while (nodeIndex != -1) {
+        const BVHNode& node = nodes[nodeIndex];
+        if (!rayAABBIntersect(ray.origin, ray.dir, node.boundsMin, node.boundsMax)) {
+            nodeIndex = node.escape;
+        } else if (node.left == -1 && node.right == -1) {
+            for (int i = node.firstTri; i < node.firstTri + node.triCount; i++) {
+                float t;
+                if (rayTriangleIntersect(ray.origin, ray.dir, triangles[i].v0, triangles[i].v1, triangles[i].v2, t) && t < hit.t) {
+                    hit.t = t;
+                    hit.tri = i;
+                    return hit;
+                }
+            }
+            nodeIndex = node.escape;
+        } else {
+            nodeIndex = node.left;
+        }
+    }
+    return hit;
+}
+
+HitInfo handStacklessWatertightClosestPacked(std::span<const BVHNode> nodes, std::span<const PackedTriangle> triangles, const Ray& ray, float tMax,
+                                             TraversalCounts*)
+{
+    HitInfo hit;
+    hit.t = tMax;
+    int nodeIndex = 0;
+    while (nodeIndex != -1) {
+        const BVHNode& node = nodes[nodeIndex];
+        if (!rayAABBIntersectRobust(ray, node.boundsMin, node.boundsMax)) {
+            nodeIndex = node.escape;
+        } else if (node.left == -1 && node.right == -1) {
+            for (int i = node.firstTri; i < node.firstTri + node.triCount; i++) {
+                vec3 v0, v1, v2;
+                decodeTriangle(node, triangles[i], v0, v1, v2);
+                float t;
+                if (rayTriangleIntersectWatertight(ray, v0, v1, v2, t) && t < hit.t) {
+                    hit.t = t;
+                    hit.tri = i;
+                }
+            }
+            nodeIndex = node.escape;
+        } else {
+            nodeIndex = node.left;
+        }
+    }
+    return hit;
+}
+
+template <typename Tri>
+struct HandLoop {
+    KernelConfig config;
+    TraceKernel<Tri> trace;
+};
+
+// fastest of a few runs, in seconds
+template <typename Fn>
+double bestSeconds(Fn fn)
+{
+    const int REPEATS = 3;
+    double best = 1e30;
+    for (int r = 0; r < REPEATS; r++) {
+        double start = nowMs();
+        fn();
+        best = std::min(best, (nowMs() - start) / 1000.0);
+    }
+    return best;
+}
+
+long countMismatches(const std::vector<HitInfo>& a, const std::vector<HitInfo>& b)
+{
+    long mismatches = 0;
+    for (size_t i = 0; i < a.size(); i++)
+        mismatches += a[i].tri != b[i].tri || a[i].t != b[i].t;
+    return mismatches;
+}
+
+template <typename Tri>
+void benchmarkKernels(const char* label, std::span<const BVHNode> nodes, std::span<const Tri> triangles, const std::vector<Ray>& rays,
+                      const std::vector<HandLoop<Tri>>& handLoops)
+{
+    const float T_MAX = 1e30f;
+    std::vector<HitInfo> expected(rays.size()), got(rays.size()), hand(rays.size());
+
+    for (Traversal traversal : {Traversal::Stack, Traversal::Stackless}) {
+        for (IntersectMode intersect : {IntersectMode::Fast, IntersectMode::Watertight}) {
+            for (Query query : {Query::ClosestHit, Query::AnyHit}) {
+                for (bool counting : {false, true}) {
+                    KernelConfig config;
+                    config.traversal = traversal;
+                    config.intersect = intersect;
+                    config.query = query;
+                    config.counts = counting;
+
+                    TraversalCounts runtimeCounts, kernelCounts;
+                    double runtimeSeconds = bestSeconds([&] {
+                        runtimeCounts = TraversalCounts();
+                        for (size_t i = 0; i < rays.size(); i++)
+                            expected[i] = runtimeTraversal(nodes, triangles, rays[i], T_MAX, config, &runtimeCounts);
+                    });
+
+                    TraceKernel<Tri> kernel = selectKernel<Tri>(config);
+                    double kernelSeconds = bestSeconds([&] {
+                        kernelCounts = TraversalCounts();
+                        for (size_t i = 0; i < rays.size(); i++)
+                            got[i] = kernel(nodes, triangles, rays[i], T_MAX, &kernelCounts);
+                    });
+                    long mismatches = countMismatches(expected, got);
+                    if (counting)
+                        mismatches += kernelCounts.nodes != runtimeCounts.nodes || kernelCounts.triangles != runtimeCounts.triangles;
+
+                    printf("%-8s %-34s %12.3f %12.3f %8.2fx", label, kernelName(config).c_str(), rays.size() / runtimeSeconds / 1e6,
+                           rays.size() / kernelSeconds / 1e6, runtimeSeconds / kernelSeconds);
+
+                    auto handLoop = std::find_if(handLoops.begin(), handLoops.end(), [&](const HandLoop<Tri>& h) {
+                        return kernelIndex(h.config) == kernelIndex(config);
+                    });
+                    if (handLoop != handLoops.end()) {
+                        double handSeconds = bestSeconds([&] {
+                            for (size_t i = 0; i < rays.size(); i++)
+                                hand[i] = handLoop->trace(nodes, triangles, rays[i], T_MAX, nullptr);
+                        });
+                        mismatches += countMismatches(expected, hand);
+                        printf(" %12.3f %10.2fx", rays.size() / handSeconds / 1e6, handSeconds / kernelSeconds);
+                    } else {
+                        printf(" %12s %11s", "-", "-");
+                    }
+
+                    printf(" %10ld", mismatches);
+                    if (counting)
+                        printf(" %10.2f %10.2f", (double) kernelCounts.nodes / rays.size(), (double) kernelCounts.triangles / rays.size());
+                    printf("\n");
+                }
+            }
+        }
+    }
+}
+
+KernelConfig handConfig(Traversal traversal, IntersectMode intersect, Query query)
+{
+    KernelConfig config;
+    config.traversal = traversal;
+    config.intersect = intersect;
+    config.query = query;
+    return config;
+}
+
+}
+
+void runKernelBenchmark(const std::vector<BVHNode>& nodes, const std::vector<Triangle>& triangles, int width, int height)
+{
+    std::vector<Ray> rays;
+    for (auto [rotX, rotY] : benchmarkViews(4)) {
+        mat4x4 mvp;
+        viewMatrix(mvp, rotX, rotY);
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                vec3 ro, rd;
+                primaryRay(mvp, (x + 0.5f) / width, (y + 0.5f) / height, ro, rd);
+                Ray ray;
+                setupRay(ray, ro, rd);
+                rays.push_back(ray);
+            }
+        }
+    }
+
+    // packing grows sbvh leaf boxes in place, so the packed triangles get their own copy of the nodes
+    std::vector<BVHNode> packedNodes = nodes;
+    std::vector<PackedTriangle> packed;
+    float maxError;
+    if (!packTriangles(packedNodes, triangles, 0, packed, maxError))
+        printf("packed triangles are past the error bound (%g), their kernels still have to agree with each other\n", maxError);
+
+    printf("%zu primary rays, best of 3 runs on one thread\n", rays.size());
+    printf("%-8s %-34s %12s %12s %9s %12s %11s %10s %10s %10s\n", "tris", "kernel", "runtime Mr/s", "kernel Mr/s", "speedup",
+           "hand Mr/s", "hand/kernel", "mismatches", "nodes/ray", "tris/ray");
+
+    std::vector<HandLoop<Triangle>> handLoops = {
+        {handConfig(Traversal::Stackless, IntersectMode::Fast, Query::ClosestHit), handStacklessFastClosest},
+        {handConfig(Traversal::Stack, IntersectMode::Fast, Query::ClosestHit), handStackFastClosest},
+        {handConfig(Traversal::Stackless, IntersectMode::Fast, Query::AnyHit), handStacklessFastAny},
+    };
+    benchmarkKernels<Triangle>("float", nodes, triangles, rays, handLoops);
+
+    std::vector<HandLoop<PackedTriangle>> packedHandLoops = {
+        {handConfig(Traversal::Stackless, IntersectMode::Watertight, Query::ClosestHit), handStacklessWatertightClosestPacked},
+    };
+    benchmarkKernels<PackedTriangle>("packed", packedNodes, packed, rays, packedHandLoops);
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "bvh.h"
+#include "compress.h"
+#include "trace.h"
+
+#include <span>
+#include <string>
+#include <vector>
+
+// the cpu traversal loops as one template over every choice that used to be a branch inside them: stack or
+// stackless walk, fast or watertight tests, closest or any hit, counting work or not, float or packed triangles.
+// each combination is its own function with the choices folded away by if constexpr, instantiated explicitly in
+// kernels.cpp, and selectKernel picks one so a batch of rays branches once instead of at every node and triangle.
+//
+// every node layout shares BVHNode, so the node side only varies by how the tree is walked
+
+enum class Traversal {
+    Stack,    // fixed 64 entry stack like the shader, drops the rest of the tree if it overflows
+    Stackless // follows the escape links from linkBVH
+};
+
+enum class Query {
+    ClosestHit,
+    AnyHit // the first triangle closer than tMax ends the walk, for occlusion rays
+};
+
+const char* traversalName(Traversal traversal);
+const char* queryName(Query query);
+
+// work done by a kernel instantiated with counting on, added to across calls
+struct TraversalCounts {
+    long nodes = 0;     // nodes whose box was tested
+    long triangles = 0; // triangle tests
+};
+
+struct KernelConfig {
+    Traversal traversal = Traversal::Stackless;
+    IntersectMode intersect = IntersectMode::Fast;
+    Query query = Query::ClosestHit;
+    bool counts = false;
+};
+
+// "stackless fast closest" and so on, with "+counts" when counting
+std::string kernelName(const KernelConfig & config);
+
+// hit.t starts at tMax, so only hits closer than it are found and a miss comes back with t = tMax. counts is only
+// read by the counting instantiations and may be null for the rest
+template <Traversal T, IntersectMode M, Query Q, bool Counts, typename Tri>
+HitInfo traceKernel(std::span<const BVHNode> nodes, std::span<const Tri> triangles, const Ray & ray, float tMax, TraversalCounts* counts);
+
+template <typename Tri>
+using TraceKernel = HitInfo (*)(std::span<const BVHNode> nodes, std::span<const Tri> triangles, const Ray & ray, float tMax,
+                                TraversalCounts* counts);
+
+// the instantiation for config, for Triangle and PackedTriangle
+template <typename Tri>
+TraceKernel<Tri> selectKernel(const KernelConfig & config);
+
+// rays/sec of every instantiation against the same loop with every choice made at run time (what trace.cpp did
+// before) and, for the common ones, a loop written out by hand for that one case. checks that all three find the
+// same hits and that the counting kernels count the same work
+void runKernelBenchmark(const std::vector<BVHNode> & nodes, const std::vector<Triangle> & triangles, int width, int height);
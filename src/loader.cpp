@@ -0,0 +1,79 @@
+#include "loader.h"
+
+#include "mesh.h"
+#include "profiling.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+
+MeshLoader::~MeshLoader()
+{
+    if (thread.joinable())
+        thread.join();
+}
+
+void MeshLoader::start(const LoadOptions & options)
+{
+    thread = std::thread(&MeshLoader::run, this, options);
+}
+
+LoadedMesh MeshLoader::takeFull()
+{
+    if (thread.joinable())
+        thread.join();
+    return std::move(fullMesh);
+}
+
+void MeshLoader::run(LoadOptions options)
+{
+    const int PREVIEW_GRID = 64;
+
+    aiVector3D min, max;
+    if (!loadMesh(options.path, fullMesh.triangles, min, max)) {
+        current.store(Failed, std::memory_order_release);
+        return;
+    }
+
+    {
+    ScopedTimer timer("preview build");
+    aiVector3D extent = max - min;
+    float cellSize = std::max(extent.x, std::max(extent.y, extent.z)) / PREVIEW_GRID;
+    simplifyMesh(fullMesh.triangles, min, max, cellSize, previewMesh.triangles);
+    // nothing survived the grid, preview the full triangles instead
+    if (previewMesh.triangles.empty())
+        previewMesh.triangles = fullMesh.triangles;
+    buildAccelerationStructure(previewMesh.nodes, previewMesh.triangles, min, max, BuildSettings());
+    }
+    printf("preview: %zu triangles\n", previewMesh.triangles.size());
+    current.store(Preview, std::memory_order_release);
+
+    buildAccelerationStructure(fullMesh.nodes, fullMesh.triangles, min, max, options.build);
+
+    if (options.lodLevels > 0) {
+        buildLODs(fullMesh.triangles, min, max, options.build, options.lodLevels, fullMesh.lods);
+        for (size_t k = 0; k < fullMesh.lods.size(); k++) {
+            const LODLevel & lod = fullMesh.lods[k];
+            printf("lod %zu: %zu triangles, %zu nodes, cell %.5f\n", k + 1, lod.triangles.size(), lod.nodes.size(), lod.cellSize);
+        }
+    }
+
+    if (options.compressTriangles) {
+        float maxError;
+        if (packTriangles(fullMesh.nodes, fullMesh.triangles, 0, fullMesh.packedTriangles, maxError)) {
+            printf("packed triangles: %.2f MB instead of %.2f MB, max vertex error %.3g\n",
+                   fullMesh.packedTriangles.size() * sizeof(PackedTriangle) / 1e6, fullMesh.triangles.size() * sizeof(Triangle) / 1e6, maxError);
+        } else {
+            printf("packed triangles are past the error bound (max error %.3g), using float triangles\n", maxError);
+            fullMesh.packedTriangles.clear();
+        }
+    }
+
+    int depth = bvhDepth(fullMesh.nodes, 0);
+    printf("bvh: %zu nodes, %zu triangle references, depth %d, sibling overlap %.3f\n",
+           fullMesh.nodes.size(), fullMesh.triangles.size(), depth, bvhSiblingOverlap(fullMesh.nodes, 0));
+    if (depth > 64)
+        printf("bvh is deeper than the 64 entry traversal stack, use the stackless traversal\n");
+
+    current.store(Full, std::memory_order_release);
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "bvh.h"
+#include "compress.h"
+#include "lod.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+struct LoadOptions {
+    const char* path = nullptr;
+    BuildSettings build;
+    int lodLevels = 0;
+    bool compressTriangles = false;
+};
+
+// a mesh ready to upload. packedTriangles is only filled when compressTriangles was asked for and the
+// error bound held
+struct LoadedMesh {
+    std::vector<BVHNode> nodes;
+    std::vector<Triangle> triangles;
+    std::vector<PackedTriangle> packedTriangles;
+    std::vector<LODLevel> lods;
+};
+
+// runs the viewer's startup off the main thread so the window and shaders come up while the mesh loads:
+// import, then a coarse preview (simplifyMesh on a 64^3 grid with its own small bvh), then the full build,
+// lods and triangle packing. the builders spread themselves over every core as before, the loader thread
+// only orders the stages. the render loop polls stage() and uploads each result as it lands.
+//
+// the preview is simplified before the full build starts because the builders reorder triangles in place
+class MeshLoader {
+public:
+    enum Stage { Loading, Preview, Full, Failed };
+
+    ~MeshLoader();
+
+    void start(const LoadOptions & options);
+
+    // stages only move forward, and what a stage published is not touched by the loader again
+    Stage stage() const { return current.load(std::memory_order_acquire); }
+
+    // valid from Preview on
+    const LoadedMesh & preview() const { return previewMesh; }
+
+    // joins the loader thread and hands over the full mesh, call once after stage() reaches Full
+    LoadedMesh takeFull();
+
+private:
+    void run(LoadOptions options);
+
+    std::thread thread;
+    std::atomic<Stage> current{Loading};
+    LoadedMesh previewMesh;
+    LoadedMesh fullMesh;
+};
@@ -0,0 +1,289 @@
+#include "lod.h"
+
+#include "bench.h"
+#include "profiling.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <array>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+
+// sum over planes n.x + d = 0 of (n.x + d)^2, as the symmetric 3x3 part, the linear part and the constant
+struct Quadric {
+    double a[6] = {}; // xx xy xz yy yz zz
+    double b[3] = {};
+    double c = 0.0;
+
+    void addPlane(const double* n, double d, double weight)
+    {
+        a[0] += weight * n[0] * n[0];
+        a[1] += weight * n[0] * n[1];
+        a[2] += weight * n[0] * n[2];
+        a[3] += weight * n[1] * n[1];
+        a[4] += weight * n[1] * n[2];
+        a[5] += weight * n[2] * n[2];
+        for (int i = 0; i < 3; i++)
+            b[i] += weight * n[i] * d;
+        c += weight * d * d;
+    }
+};
+
+struct Cluster {
+    Quadric q;
+    double sum[3] = {};
+    int count = 0;
+    int cell[3];
+    float position[3];
+};
+
+uint64_t cellKey(const int* cell)
+{
+    return ((uint64_t) cell[0] << 42) | ((uint64_t) cell[1] << 21) | (uint64_t) cell[2];
+}
+
+// the point minimizing the quadric, pulled slightly towards the vertex average so flat and edge-only
+// cells (where the 3x3 is singular) still have an answer, then clamped into the cell
+void placeCluster(Cluster & cluster, const float* cellMin, float cellSize)
+{
+    double mean[3];
+    for (int i = 0; i < 3; i++)
+        mean[i] = cluster.sum[i] / cluster.count;
+
+    const double* a = cluster.q.a;
+    double lambda = 1e-3 * (a[0] + a[3] + a[5]) / 3.0 + 1e-12;
+    double m[3][3] = {
+        {a[0] + lambda, a[1], a[2]},
+        {a[1], a[3] + lambda, a[4]},
+        {a[2], a[4], a[5] + lambda},
+    };
+    double r[3];
+    for (int i = 0; i < 3; i++)
+        r[i] = lambda * mean[i] - cluster.q.b[i];
+
+    // cramer's rule, m is symmetric positive definite after the regularization
+    double det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+               - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+               + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+    double x[3] = {mean[0], mean[1], mean[2]};
+    if (fabs(det) > 1e-30) {
+        for (int col = 0; col < 3; col++) {
+            double mc[3][3];
+            for (int i = 0; i < 3; i++)
+                for (int j = 0; j < 3; j++)
+                    mc[i][j] = j == col ? r[i] : m[i][j];
+            x[col] = (mc[0][0] * (mc[1][1] * mc[2][2] - mc[1][2] * mc[2][1])
+                    - mc[0][1] * (mc[1][0] * mc[2][2] - mc[1][2] * mc[2][0])
+                    + mc[0][2] * (mc[1][0] * mc[2][1] - mc[1][1] * mc[2][0])) / det;
+        }
+    }
+
+    for (int i = 0; i < 3; i++) {
+        float lo = cellMin[i] + cluster.cell[i] * cellSize;
+        cluster.position[i] = std::clamp((float) x[i], lo, lo + cellSize);
+    }
+}
+
+struct TripleHash {
+    size_t operator()(const std::array<int, 3> & t) const
+    {
+        return std::hash<uint64_t>()(((uint64_t) t[0] * 0x9e3779b97f4a7c15ull) ^ ((uint64_t) t[1] << 21) ^ (uint64_t) t[2]);
+    }
+};
+
+}
+
+void simplifyMesh(const std::vector<Triangle> & triangles, aiVector3D min, aiVector3D max, float cellSize, std::vector<Triangle> & out)
+{
+    const float cellMin[3] = {min.x, min.y, min.z};
+    // the grid ends at max, a vertex on the far face goes in the last cell rather than a sliver one past it
+    int lastCell[3];
+    for (int i = 0; i < 3; i++)
+        lastCell[i] = (int) std::clamp(ceilf((max[i] - min[i]) / cellSize) - 1.0f, 0.0f, (float) ((1 << 21) - 1));
+
+    std::vector<Cluster> clusters;
+    std::unordered_map<uint64_t, int> clusterOf;
+    std::vector<int> corners(triangles.size() * 3);
+
+    for (size_t t = 0; t < triangles.size(); t++) {
+        const Triangle & tri = triangles[t];
+        const float* v[3] = {tri.v0, tri.v1, tri.v2};
+
+        // plane of the triangle weighted by its area, so big triangles decide where the cell vertex goes
+        double e1[3], e2[3], n[3];
+        for (int i = 0; i < 3; i++) {
+            e1[i] = v[1][i] - v[0][i];
+            e2[i] = v[2][i] - v[0][i];
+        }
+        n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+        n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+        n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+        double length = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        double area = 0.5 * length;
+        if (length > 0.0)
+            for (int i = 0; i < 3; i++)
+                n[i] /= length;
+        double d = -(n[0] * v[0][0] + n[1] * v[0][1] + n[2] * v[0][2]);
+
+        for (int k = 0; k < 3; k++) {
+            int cell[3];
+            for (int i = 0; i < 3; i++)
+                cell[i] = std::clamp((int) ((v[k][i] - cellMin[i]) / cellSize), 0, lastCell[i]);
+            auto [it, inserted] = clusterOf.try_emplace(cellKey(cell), (int) clusters.size());
+            if (inserted) {
+                clusters.emplace_back();
+                std::copy(cell, cell + 3, clusters.back().cell);
+            }
+            Cluster & cluster = clusters[it->second];
+            if (length > 0.0)
+                cluster.q.addPlane(n, d, area);
+            for (int i = 0; i < 3; i++)
+                cluster.sum[i] += v[k][i];
+            cluster.count++;
+            corners[3 * t + k] = it->second;
+        }
+    }
+
+    for (Cluster & cluster : clusters)
+        placeCluster(cluster, cellMin, cellSize);
+
+    // a triangle survives if its corners landed in three different cells, once per set of cells
+    out.clear();
+    std::unordered_set<std::array<int, 3>, TripleHash> seen;
+    for (size_t t = 0; t < triangles.size(); t++) {
+        const int* c = &corners[3 * t];
+        if (c[0] == c[1] || c[1] == c[2] || c[0] == c[2])
+            continue;
+        std::array<int, 3> key = {c[0], c[1], c[2]};
+        std::sort(key.begin(), key.end());
+        if (!seen.insert(key).second)
+            continue;
+
+        Triangle tri = {};
+        float* v[3] = {tri.v0, tri.v1, tri.v2};
+        for (int k = 0; k < 3; k++)
+            std::copy(clusters[c[k]].position, clusters[c[k]].position + 3, v[k]);
+
+        vec3 e1, e2, n;
+        vec3_sub(e1, tri.v1, tri.v0);
+        vec3_sub(e2, tri.v2, tri.v0);
+        vec3_mul_cross(n, e1, e2);
+        float length = vec3_len(n);
+        if (length == 0.0f)
+            continue;
+        for (int i = 0; i < 3; i++)
+            tri.normal[i] = n[i] / length;
+        setTriangleId(tri, triangleId(triangles[t]));
+        out.push_back(tri);
+    }
+}
+
+void buildLODs(const std::vector<Triangle> & triangles, aiVector3D min, aiVector3D max, const BuildSettings & settings,
+               int count, std::vector<LODLevel> & lods)
+{
+    ScopedTimer timer("lod build");
+    const size_t MIN_TRIANGLES = 64;
+
+    double edgeSum = 0.0;
+    for (const Triangle & t : triangles) {
+        vec3 e;
+        vec3_sub(e, t.v1, t.v0);
+        edgeSum += vec3_len(e);
+        vec3_sub(e, t.v2, t.v1);
+        edgeSum += vec3_len(e);
+        vec3_sub(e, t.v0, t.v2);
+        edgeSum += vec3_len(e);
+    }
+    float cellSize = triangles.empty() ? 0.0f : (float) (2.0 * edgeSum / (3.0 * triangles.size()));
+
+    lods.clear();
+    size_t previous = triangles.size();
+    for (int level = 0; level < count && previous > MIN_TRIANGLES; level++) {
+        double start = nowMs();
+        LODLevel lod;
+        lod.cellSize = cellSize;
+        simplifyMesh(triangles, min, max, cellSize, lod.triangles);
+        cellSize *= 2.0f;
+        // a cell smaller than the triangles barely changes anything, try the next size up
+        if (lod.triangles.size() * 10 > previous * 9)
+            continue;
+        if (lod.triangles.empty())
+            break;
+        buildAccelerationStructure(lod.nodes, lod.triangles, min, max, settings);
+        lod.buildMs = nowMs() - start;
+        previous = lod.triangles.size();
+        lods.push_back(std::move(lod));
+    }
+}
+
+float pixelFootprint(mat4x4 const mvp, int width, int height)
+{
+    // primaryRay spreads u and v across the first two columns of mvp
+    float du = vec3_len(mvp[0]) / width;
+    float dv = vec3_len(mvp[1]) / height;
+    return std::max(du, dv);
+}
+
+int selectLOD(const std::vector<LODLevel> & lods, float footprint, float bias)
+{
+    int level = 0;
+    for (int k = 0; k < (int) lods.size(); k++)
+        if (lods[k].cellSize <= bias * footprint)
+            level = k + 1;
+    return level;
+}
+
+void runLODBenchmark(const std::vector<BVHNode> & nodes, const std::vector<Triangle> & triangles,
+                     const std::vector<LODLevel> & lods, float bias)
+{
+    const int SIZE = 256;
+    const std::vector<std::pair<float, float>> views = benchmarkViews(4);
+
+    // coverage against the full mesh, per pixel hit or miss
+    auto coverage = [&](const std::vector<BVHNode> & n, const std::vector<Triangle> & t) {
+        std::vector<bool> hits;
+        for (auto [rotX, rotY] : views) {
+            mat4x4 mvp;
+            viewMatrix(mvp, rotX, rotY);
+            for (int y = 0; y < SIZE; y++) {
+                for (int x = 0; x < SIZE; x++) {
+                    vec3 ro, rd;
+                    primaryRay(mvp, (x + 0.5f) / SIZE, (y + 0.5f) / SIZE, ro, rd);
+                    hits.push_back(closestHitFromBVHStackless(n, t, ro, rd).tri != -1);
+                }
+            }
+        }
+        return hits;
+    };
+    std::vector<bool> reference = coverage(nodes, triangles);
+
+    printf("%5s %12s %10s %10s %10s %10s %10s %12s\n", "lod", "triangles", "nodes", "MB", "cell", "build ms", "Mrays/s", "coverage diff");
+    for (int level = 0; level <= (int) lods.size(); level++) {
+        const std::vector<BVHNode> & n = level == 0 ? nodes : lods[level - 1].nodes;
+        const std::vector<Triangle> & t = level == 0 ? triangles : lods[level - 1].triangles;
+        double mb = (n.size() * sizeof(BVHNode) + t.size() * sizeof(Triangle)) / 1e6;
+
+        TraceStats stats = traceViews(n, t, SIZE, SIZE, views);
+        std::vector<bool> hits = coverage(n, t);
+        long differ = 0;
+        for (size_t i = 0; i < hits.size(); i++)
+            differ += hits[i] != reference[i];
+
+        printf("%5d %12zu %10zu %10.2f %10.5f %10.1f %10.3f %11.3f%%\n", level, t.size(), n.size(), mb,
+               level == 0 ? 0.0f : lods[level - 1].cellSize, level == 0 ? 0.0 : lods[level - 1].buildMs,
+               stats.rays / stats.seconds / 1e6, 100.0 * differ / hits.size());
+    }
+
+    printf("\n%10s %12s %5s\n", "resolution", "footprint", "lod");
+    mat4x4 mvp;
+    viewMatrix(mvp, 0.0f, 0.0f);
+    for (int size = 64; size <= 4096; size *= 2) {
+        float footprint = pixelFootprint(mvp, size, size);
+        printf("%10d %12.5f %5d\n", size, footprint, selectLOD(lods, footprint, bias));
+    }
+}
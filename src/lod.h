@@ -0,0 +1,37 @@
+#pragma once
+
+#include "bvh.h"
+#include "linmath.h"
+
+#include <vector>
+
+// a simplified copy of the mesh with its own bvh
+struct LODLevel {
+    std::vector<BVHNode> nodes;
+    std::vector<Triangle> triangles;
+    float cellSize = 0.0f; // clustering grid cell, every vertex moved less than a cell diagonal
+    double buildMs = 0.0;  // simplify + bvh build
+};
+
+// quadric error clustering (Lindstrom 2000): snaps every vertex to a grid of cellSize from min to max, places each
+// occupied cell's vertex where it best fits the planes of the triangles around it (kept inside the cell), and drops
+// the triangles that collapse. one pass over the triangles, so it keeps up with loading a 10M triangle mesh where
+// edge collapse wouldn't. triangle ids are those of one of the source triangles that became each output triangle
+void simplifyMesh(const std::vector<Triangle> & triangles, aiVector3D min, aiVector3D max, float cellSize, std::vector<Triangle> & out);
+
+// up to count simplified levels, each with twice the cell size of the one before starting at twice the mean edge
+// length, stopping early once a level gets down to a handful of triangles. lods[0] is the first simplified level,
+// the full mesh is not copied. timed as the "lod build" stage
+void buildLODs(const std::vector<Triangle> & triangles, aiVector3D min, aiVector3D max, const BuildSettings & settings,
+               int count, std::vector<LODLevel> & lods);
+
+// world space width of one pixel. the camera is orthographic so every primary ray of a view has the same footprint
+float pixelFootprint(mat4x4 const mvp, int width, int height);
+
+// the coarsest level whose cells are no bigger than bias pixels, 0 for the full mesh and k for lods[k - 1]
+int selectLOD(const std::vector<LODLevel> & lods, float footprint, float bias = 1.0f);
+
+// triangles, memory, build time and rays/sec of every level at a few resolutions, with the pixels that differ
+// from the full mesh and the level selectLOD picks at each resolution
+void runLODBenchmark(const std::vector<BVHNode> & nodes, const std::vector<Triangle> & triangles,
+                     const std::vector<LODLevel> & lods, float bias);
@@ -13,10 +13,24 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <memory>
  
-#include <assimp/Importer.hpp>      // C++ importer interface
-#include <assimp/scene.h>           // Output data structure
-#include <assimp/postprocess.h>     // Post processing flags
+#include "batch.h"
+#include "bench.h"
+#include "bvh.h"
+#include "compress.h"
+#include "distributed.h"
+#include "incremental.h"
+#include "kernels.h"
+#include "loader.h"
+#include "lod.h"
+#include "mesh.h"
+#include "profiling.h"
+#include "query_server.h"
+#include "raysort.h"
+#include "trace.h"
+#include "upload.h"
+#include "verify.h"
 
 
 static void error_callback(int error, const char* description)
@@ -24,10 +38,62 @@ static void error_callback(int error, const char* description)
     fprintf(stderr, "Error: %s\n", description);
 }
  
+bool showOverlay = true;
+bool vsyncEnabled = true;
+bool stacklessTraversal = true;
+bool watertightIntersect = false;
+bool editRequested = false;
+int viewMode = 0; // 0 traces the bvh, 1 tests every triangle, 2 draws the boxes
+
 static void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
     if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
         glfwSetWindowShouldClose(window, GLFW_TRUE);
+    // F1 toggles the frame time graph, V toggles vsync for benchmarking
+    if (key == GLFW_KEY_F1 && action == GLFW_PRESS)
+        showOverlay = !showOverlay;
+    if (key == GLFW_KEY_V && action == GLFW_PRESS)
+    {
+        vsyncEnabled = !vsyncEnabled;
+        glfwSwapInterval(vsyncEnabled ? 1 : 0);
+    }
+    // T switches between the stack and stackless bvh traversal
+    if (key == GLFW_KEY_T && action == GLFW_PRESS)
+        stacklessTraversal = !stacklessTraversal;
+    // W switches between the fast and watertight intersection tests
+    if (key == GLFW_KEY_W && action == GLFW_PRESS)
+        watertightIntersect = !watertightIntersect;
+    // B cycles through the bvh trace, the naive trace and the box view
+    if (key == GLFW_KEY_B && action == GLFW_PRESS)
+        viewMode = (viewMode + 1) % 3;
+    // E dents the mesh where the middle of the screen looks and updates the bvh incrementally
+    if (key == GLFW_KEY_E && action == GLFW_PRESS)
+        editRequested = true;
+}
+
+// replaces what both buffers hold. float triangles are read from binding 0 and packed ones from binding 2
+static void uploadBVH(UploadRing& ring, DeviceBuffer& bvhBuffer, DeviceBuffer& triangleBuffer, std::span<const BVHNode> nodes, const void* triangles, size_t triangleBytes, bool packed)
+{
+    bvhBuffer.reserve(nodes.size_bytes());
+    ring.upload(bvhBuffer, 0, nodes.data(), nodes.size_bytes());
+    bvhBuffer.bind(1);
+    triangleBuffer.reserve(triangleBytes);
+    ring.upload(triangleBuffer, 0, triangles, triangleBytes);
+    triangleBuffer.bind(packed ? 2 : 0);
+}
+
+// uploads each [first, last) element range through the ring, returns the bytes sent
+static size_t uploadRanges(UploadRing& ring, DeviceBuffer& buffer, const std::vector<std::pair<int, int>>& ranges, size_t elementSize, const void* data)
+{
+    size_t bytes = 0;
+    for (auto range : ranges)
+    {
+        size_t offset = range.first * elementSize;
+        size_t size = (range.second - range.first) * elementSize;
+        ring.upload(buffer, offset, (const char*) data + offset, size);
+        bytes += size;
+    }
+    return bytes;
 }
 
 static std::string LoadFile(const char* path)
@@ -44,6 +110,8 @@ static std::string LoadFile(const char* path)
     return buffer.str();
 }
 
+static const char* DEFAULT_MESH = "C:/Users/oliox/Documents/Code/Mesh-Raytracing/meshes/closed/camel_simple.obj";
+
 bool mouseDown = false;
 double lastX = 0.0, lastY = 0.0;
 float rotX = 0.0f;  // rotation around X axis
@@ -110,207 +178,379 @@ void CheckShaderCompile(GLuint shader, const char* name)
     }
 }
 
-// array of triangles
-// array of boxes -> pointer to children, list of faces in them
-
-// top level A is all faces
-// build child -> pass through faces and put into either left right or both
-// nlogn
-//split over largest axis
-// build in xyz axes
-//if triangle is on border, always assign it to first, then expand first to overlap second so it fully covers those triangles
-
-struct alignas(16) Triangle {
-    float v0[4];   // xyz + padding
-    float v1[4];
-    float v2[4];
-    float normal[4];
-};
 
-struct alignas(16) BVHNode {
-    float boundsMin[4]; // xyz + padding
-    float boundsMax[4];
-    int left;
-    int right;
-    int firstTri;
-    int triCount;
+struct MeshVertex {
+    float position[3];
+    float normal[3];
+    float uv[2];
 };
 
 
-//A must be a list of triangles inside 
-int buildBVHNode(std::vector<BVHNode> & bounding_volumes, std::vector<Triangle> & triangles, int firstTri, int numTri, aiVector3D min, aiVector3D max, int lastAxis, int failedSplits)
+int main(int argc, char** argv)
 {
-    // if (bounding_volumes.size() == 0) {
-    // printf("this node min: %f %f %f \n", min.x, min.y, min[2]);
-    // printf("this node max: %f %f %f \n", max.x, max.y, max[2]);
-    // }
-    BVHNode b;
-    bounding_volumes.emplace_back(b);   // construct in-place
-    int idx = bounding_volumes.size() - 1;
-    // bounding_volumes[idx].boundsMin[0] = mesh->mAABB.mMin.x;
-    // bounding_volumes[idx].boundsMin[1] = mesh->mAABB.mMin.y;
-    // bounding_volumes[idx].boundsMin[2] = mesh->mAABB.mMin.z;
-    // bounding_volumes[idx].boundsMax[0] = mesh->mAABB.mMax.x;
-    // bounding_volumes[idx].boundsMax[1] = mesh->mAABB.mMax.y;
-    // bounding_volumes[idx].boundsMax[2] = mesh->mAABB.mMax.z;
-
-    // xLen = max.x-min.x;
-    // yLen = max.y-min.y;
-    // zLen = max.z-min.z;
-
-    // std::vector<int> vec = {xLen, yLen, zLen};
-    // auto max_it = std::max_element(vec.begin(), vec.end());
-
-    // // Calculate the distance (index) from the beginning of the vector to the max element
-    // int axis = static_cast<int>(std::distance(vec.begin(), max_it));
-    //rotate through all 3 axes
-    int axis = (lastAxis + 1) % 3;
-    
-    auto leftMin = min;
-    auto leftMax = max;
-    leftMax[axis] = (min[axis] + max[axis])/2;
-
-    auto rightMin = min;
-    auto rightMax = max;
-    rightMin[axis] = (min[axis] + max[axis])/2;
-
-    auto pivot = (min[axis] + max[axis])/2;
-    //loop through triangles, if centerpoint(?) is less than pivot put in left otherwise right
-    // store max overflow, expand left box size to cover that overflow
-    if (numTri != 0 && numTri != 1) { 
-        std::vector<Triangle> leftPartition;
-        std::vector<Triangle> rightPartition;
-        float maxPointInLeft = pivot;
-        float minPointInRight = pivot;
-        for (int i = firstTri; i < firstTri+numTri; i++) {
-            auto tri = triangles[i];
-            float pos = (tri.v0[axis] + tri.v1[axis] + tri.v2[axis])/3;
-            // if triangle is on the boundary put into left side, then expand left side to fully cover
-            // this might not terminate, better way could be to use midpoint and grow both right and left side
-            if (pos < pivot) {
-                leftPartition.push_back(triangles[i]);
-                float maxVert = std::max(tri.v0[axis], std::max(tri.v1[axis], tri.v2[axis]));
-                if (maxVert > maxPointInLeft) {
-                    maxPointInLeft = maxVert;
-                }
-            } else {
-                rightPartition.push_back(triangles[i]);
-                float minVert = std::min(tri.v0[axis], std::min(tri.v1[axis], tri.v2[axis]));
-                if (minVert < minPointInRight) {
-                    minPointInRight = minVert;
-                }
-            }
+    // nowMs counts from its first call, so this is program start for the startup metrics
+    const double startMs = nowMs();
+    const char* csvPath = nullptr;
+    BuildSettings buildSettings;
+    bool benchLayout = false;
+    bool benchIntersect = false;
+    bool benchCompress = false;
+    bool benchEdit = false;
+    bool benchLOD = false;
+    bool benchRaySort = false;
+    bool benchShading = false;
+    bool benchUpload = false;
+    bool benchKernels = false;
+    ShadingOptions shading;
+    int lodLevels = 0;
+    float lodBias = 1.0f;
+    bool compressTriangles = false;
+    bool verify = false;
+    std::vector<const char*> meshPaths;
+    BatchOptions batch;
+    CoordinatorOptions coordinator;
+    WorkerOptions worker;
+    bool workerMode = false;
+    QueryServerOptions server;
+    bool serverMode = false;
+    QueryBenchmarkOptions queryBench;
+    bool queryBenchMode = false;
+    int renderWidth = 0, renderHeight = 0; // --size, each mode has its own default
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--no-vsync")
+            vsyncEnabled = false;
+        else if (arg == "--no-overlay")
+            showOverlay = false;
+        else if (arg == "--view" && i + 1 < argc)
+        {
+            std::string view = argv[++i];
+            if (view == "bvh")
+                viewMode = 0;
+            else if (view == "naive")
+                viewMode = 1;
+            else if (view == "boxes")
+                viewMode = 2;
+            else
+                fprintf(stderr, "Unknown view: %s\n", argv[i]);
+        }
+        else if (arg == "--traversal" && i + 1 < argc)
+        {
+            std::string traversal = argv[++i];
+            if (traversal == "stack" || traversal == "stackless")
+                stacklessTraversal = traversal == "stackless";
+            else
+                fprintf(stderr, "Unknown traversal: %s\n", argv[i]);
+        }
+        else if (arg == "--intersect" && i + 1 < argc)
+        {
+            std::string intersect = argv[++i];
+            if (intersect == "fast" || intersect == "watertight")
+                watertightIntersect = intersect == "watertight";
+            else
+                fprintf(stderr, "Unknown intersect: %s\n", argv[i]);
         }
-        //ensures all triangles are fully enclosed
-        // this could leave triangles which are actually in other bounding boxes and not counted. But every triangle will exist in exactly one box per level and the array wont be messed with (i hope)
-        if (maxPointInLeft > pivot) {
-            leftMax[axis] = maxPointInLeft;
+        else if (arg == "--builder" && i + 1 < argc)
+        {
+            std::string builder = argv[++i];
+            if (builder == "midpoint" || builder == "sbvh")
+                buildSettings.sbvh = builder == "sbvh";
+            else
+                fprintf(stderr, "Unknown builder: %s\n", argv[i]);
         }
-        if (minPointInRight < pivot) {
-            rightMin[axis] = minPointInRight;
+        else if (arg == "--split-budget" && i + 1 < argc)
+        {
+            // the builder sizes its reference list from this, a negative budget would wrap it. NaN fails both tests
+            float budget = (float) atof(argv[++i]);
+            if (budget >= 0.0f && budget <= MAX_SPLIT_BUDGET)
+                buildSettings.sbvhOptions.splitBudget = budget;
+            else
+                fprintf(stderr, "Invalid split budget: %s\n", argv[i]);
         }
-        //overwrite back into triangles
-        for (int i = firstTri; i < firstTri+leftPartition.size(); i++) {
-            triangles[i] = leftPartition[i-firstTri];
+        else if (arg == "--layout" && i + 1 < argc)
+        {
+            if (!parseNodeLayout(argv[++i], buildSettings.layout))
+                fprintf(stderr, "Unknown layout: %s\n", argv[i]);
         }
-        for (int i = firstTri+leftPartition.size(); i < firstTri+numTri; i++) {
-            triangles[i] = rightPartition[i-firstTri-leftPartition.size()];
+        else if (arg == "--reorder-triangles")
+            buildSettings.reorderTriangles = true;
+        else if (arg == "--bench-layout")
+            benchLayout = true;
+        else if (arg == "--bench-intersect")
+            benchIntersect = true;
+        else if (arg == "--compress-triangles")
+            compressTriangles = true;
+        else if (arg == "--bench-compress")
+            benchCompress = true;
+        else if (arg == "--bench-edit")
+            benchEdit = true;
+        else if (arg == "--lod" && i + 1 < argc)
+            lodLevels = atoi(argv[++i]);
+        else if (arg == "--lod-bias" && i + 1 < argc)
+            lodBias = (float) atof(argv[++i]);
+        else if (arg == "--bench-lod")
+            benchLOD = true;
+        else if (arg == "--bench-raysort")
+            benchRaySort = true;
+        else if (arg == "--shading" && i + 1 < argc)
+        {
+            if (!parseShadingMode(argv[++i], shading.mode))
+                fprintf(stderr, "Unknown shading: %s\n", argv[i]);
         }
+        else if (arg == "--samples" && i + 1 < argc)
+            shading.samples = atoi(argv[++i]);
+        else if (arg == "--bounces" && i + 1 < argc)
+            shading.bounces = atoi(argv[++i]);
+        else if (arg == "--ao-distance" && i + 1 < argc)
+            shading.aoDistance = (float) atof(argv[++i]);
+        else if (arg == "--bench-shading")
+            benchShading = true;
+        else if (arg == "--bench-upload")
+            benchUpload = true;
+        else if (arg == "--bench-kernels")
+            benchKernels = true;
+        else if (arg == "--verify")
+            verify = true;
+        else if (arg == "--mesh" && i + 1 < argc)
+            meshPaths.push_back(argv[++i]);
+        else if (arg == "--batch" && i + 1 < argc)
+            batch.cameraPath = argv[++i];
+        else if (arg == "--coordinator" && i + 1 < argc)
+            coordinator.cameraPath = argv[++i];
+        else if (arg == "--workers" && i + 1 < argc)
+            coordinator.workers = atoi(argv[++i]);
+        else if (arg == "--port" && i + 1 < argc)
+            coordinator.port = atoi(argv[++i]);
+        else if (arg == "--bvh" && i + 1 < argc)
+            coordinator.bvhPath = server.bvhPath = worker.bvhPath = argv[++i];
+        else if (arg == "--scaling")
+            coordinator.scaling = true;
+        else if (arg == "--worker" && i + 1 < argc)
+        {
+            workerMode = true;
+            worker.address = argv[++i];
+        }
+        else if (arg == "--worker-fail-after" && i + 1 < argc)
+            coordinator.failAfter = worker.failAfter = atoi(argv[++i]);
+        else if (arg == "--serve" && i + 1 < argc)
+        {
+            serverMode = true;
+            server.socketPath = argv[++i];
+        }
+        else if (arg == "--batch-rays" && i + 1 < argc)
+            server.batchRays = atoi(argv[++i]);
+        else if (arg == "--coalesce-us" && i + 1 < argc)
+            server.coalesceUs = atof(argv[++i]);
+        else if (arg == "--query-bench" && i + 1 < argc)
+        {
+            queryBenchMode = true;
+            queryBench.socketPath = argv[++i];
+        }
+        else if (arg == "--clients" && i + 1 < argc)
+            queryBench.clients = atoi(argv[++i]);
+        else if (arg == "--rays-per-request" && i + 1 < argc)
+            queryBench.raysPerRequest = atoi(argv[++i]);
+        else if (arg == "--requests" && i + 1 < argc)
+            queryBench.requests = atoi(argv[++i]);
+        else if (arg == "--in-flight" && i + 1 < argc)
+            queryBench.inFlight = atoi(argv[++i]);
+        else if (arg == "--out" && i + 1 < argc)
+            batch.outDir = argv[++i];
+        else if (arg == "--size" && i + 1 < argc)
+        {
+            if (sscanf(argv[++i], "%dx%d", &renderWidth, &renderHeight) != 2)
+                fprintf(stderr, "Expected --size WIDTHxHEIGHT, got %s\n", argv[i]);
+        }
+        else if (arg == "--tile" && i + 1 < argc)
+            batch.tileSize = atoi(argv[++i]);
+        else if (arg == "--threads" && i + 1 < argc)
+            batch.threads = atoi(argv[++i]);
+        else if (arg == "--csv" && i + 1 < argc)
+            csvPath = argv[++i];
+        else
+            fprintf(stderr, "Unknown argument: %s\n", arg.c_str());
+    }
 
-        //todo dont make extra children for efficiency
-        // Avoid infinite loop where it halves in the long axis but then a really long triangle in that axis just regrows it to the same size
-        //this causes early termination though
-        if (leftPartition.size() == numTri || rightPartition.size() == numTri) {
-            if (failedSplits == 2) {
-                bounding_volumes[idx].left = -1;
-                bounding_volumes[idx].right = -1;
-            } else {
-                bounding_volumes[idx].left = buildBVHNode(bounding_volumes, triangles, firstTri, leftPartition.size(), leftMin, leftMax, axis, failedSplits + 1);
-                bounding_volumes[idx].right = buildBVHNode(bounding_volumes, triangles, firstTri + leftPartition.size(), rightPartition.size(), rightMin, rightMax, axis, failedSplits + 1);
-            }
-        } else {
-            bounding_volumes[idx].left = buildBVHNode(bounding_volumes, triangles, firstTri, leftPartition.size(), leftMin, leftMax, axis, 0);
-            bounding_volumes[idx].right = buildBVHNode(bounding_volumes, triangles, firstTri + leftPartition.size(), rightPartition.size(), rightMin, rightMax, axis, 0);
+    ProfileLog profileLog;
+    if (csvPath)
+        profileLog.open(csvPath);
+
+    if (batch.cameraPath)
+    {
+        batch.meshes = meshPaths;
+        batch.build = buildSettings;
+        batch.lodLevels = lodLevels;
+        batch.lodBias = lodBias;
+        batch.shading = shading;
+        if (renderWidth > 0)
+        {
+            batch.width = renderWidth;
+            batch.height = renderHeight;
         }
+        exit(runBatch(batch));
+    }
 
-    } else {
-        bounding_volumes[idx].left = -1;
-        bounding_volumes[idx].right = -1;
+    if (workerMode)
+    {
+        worker.threads = batch.threads > 0 ? batch.threads : 1;
+        exit(runWorker(worker));
     }
-    //todo add termination condition
-    bounding_volumes[idx].firstTri = firstTri;
-    bounding_volumes[idx].triCount = numTri;
-    bounding_volumes[idx].boundsMin[0] = min.x;
-    bounding_volumes[idx].boundsMin[1] = min.y;
-    bounding_volumes[idx].boundsMin[2] = min.z;
-    bounding_volumes[idx].boundsMax[0] = max.x;
-    bounding_volumes[idx].boundsMax[1] = max.y;
-    bounding_volumes[idx].boundsMax[2] = max.z;
-    return idx;
-}
 
-struct MeshVertex {
-    float position[3];
-    float normal[3];
-    float uv[2];
-};
+    if (coordinator.cameraPath)
+    {
+        coordinator.executable = argv[0];
+        coordinator.mesh = meshPaths.empty() ? nullptr : meshPaths[0];
+        coordinator.outDir = batch.outDir;
+        coordinator.tileSize = batch.tileSize;
+        coordinator.workerThreads = batch.threads > 0 ? batch.threads : 1;
+        coordinator.build = buildSettings;
+        if (renderWidth > 0)
+        {
+            coordinator.width = renderWidth;
+            coordinator.height = renderHeight;
+        }
+        exit(runCoordinator(coordinator));
+    }
 
-void printBVHTriangles(BVHNode b) {
-    for (int i = b.firstTri; i < b.firstTri + b.triCount; i++) {
-        printf("%d ", i);
+    if (serverMode)
+    {
+        server.mesh = meshPaths.empty() ? nullptr : meshPaths[0];
+        server.outDir = batch.outDir;
+        server.threads = batch.threads;
+        server.build = buildSettings;
+        exit(runQueryServer(server));
     }
-    printf("\n");
-}
 
+    if (queryBenchMode)
+        exit(runQueryBenchmark(queryBench));
 
-int main(void)
-{
+    if (verify)
+    {
+        VerifyOptions verifyOptions;
+        verifyOptions.meshes = meshPaths;
+        if (verifyOptions.meshes.empty())
+            verifyOptions.meshes.push_back(DEFAULT_MESH);
+        verifyOptions.threads = batch.threads;
+        if (renderWidth > 0)
+        {
+            verifyOptions.width = renderWidth;
+            verifyOptions.height = renderHeight;
+        }
+        exit(runVerify(verifyOptions));
+    }
 
-    Assimp::Importer importer;
-    const aiScene* scene = importer.ReadFile("C:/Users/oliox/Documents/Code/Mesh-Raytracing/meshes/closed/camel_simple.obj", 
-                                            aiProcess_Triangulate | 
-                                            aiProcess_FlipUVs | 
-                                            aiProcess_GenNormals |
-                                            aiProcess_GenBoundingBoxes);
+    // NOTE: OpenGL error checks have been omitted for brevity
+    const char* meshPath = meshPaths.empty() ? DEFAULT_MESH : meshPaths[0];
+    if (benchLayout || benchIntersect || benchEdit || benchLOD || benchCompress || benchRaySort || benchShading || benchUpload || benchKernels)
+    {
+        std::vector<Triangle> triangles;
+        std::vector<BVHNode> bounding_volumes;
+        aiVector3D meshMin, meshMax;
+        if (!loadMesh(meshPath, triangles, meshMin, meshMax))
+            exit(EXIT_FAILURE);
 
-    aiMesh* mesh = scene->mMeshes[0]; // load first mesh
-    // normalize mesh
-    aiVector3D center = (mesh->mAABB.mMin + mesh->mAABB.mMax) * 0.5f;
-    aiVector3D extent = mesh->mAABB.mMax - mesh->mAABB.mMin;
+        if (benchLayout)
+        {
+            BuildSettings asBuilt = buildSettings;
+            asBuilt.layout = NodeLayout::Recursion;
+            asBuilt.reorderTriangles = false;
+            buildAccelerationStructure(bounding_volumes, triangles, meshMin, meshMax, asBuilt);
+            runLayoutBenchmark(bounding_volumes, triangles, 0, 512, 512);
+            exit(EXIT_SUCCESS);
+        }
 
-    float maxExtent = std::max(extent.x, std::max(extent.y, extent.z));
-    float scale = 1.0f / maxExtent;   // fits into [-0.5, 0.5]
+        buildAccelerationStructure(bounding_volumes, triangles, meshMin, meshMax, buildSettings);
 
-    for (unsigned int m = 0; m < scene->mNumMeshes; ++m)
-    {
-        aiMesh* mesh = scene->mMeshes[m];
+        if (benchIntersect)
+        {
+            runIntersectBenchmark(bounding_volumes, triangles, renderWidth > 0 ? renderWidth : 512, renderHeight > 0 ? renderHeight : 512);
+            exit(EXIT_SUCCESS);
+        }
 
-        for (unsigned int v = 0; v < mesh->mNumVertices; ++v)
+        if (benchKernels)
         {
-            mesh->mVertices[v] -= center;
-            mesh->mVertices[v] *= scale;
+            runKernelBenchmark(bounding_volumes, triangles, renderWidth > 0 ? renderWidth : 256, renderHeight > 0 ? renderHeight : 256);
+            exit(EXIT_SUCCESS);
         }
 
-        // Optional: renormalize normals (safe practice)
-        if (mesh->HasNormals())
+        if (benchRaySort)
         {
-            for (unsigned int v = 0; v < mesh->mNumVertices; ++v)
+            runRaySortBenchmark(bounding_volumes, triangles, renderWidth > 0 ? renderWidth : 256, renderHeight > 0 ? renderHeight : 256);
+            exit(EXIT_SUCCESS);
+        }
+
+        if (benchShading)
+        {
+            runShadingBenchmark(bounding_volumes, triangles, renderWidth > 0 ? renderWidth : 256, renderHeight > 0 ? renderHeight : 256, shading);
+            exit(EXIT_SUCCESS);
+        }
+
+        if (benchUpload)
+        {
+            // needs a context but nothing on screen
+            glfwSetErrorCallback(error_callback);
+            if (!glfwInit())
+                exit(EXIT_FAILURE);
+            glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+            glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+            glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+            glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+            GLFWwindow* window = glfwCreateWindow(64, 64, "upload benchmark", NULL, NULL);
+            if (!window)
             {
-                mesh->mNormals[v].Normalize();
+                glfwTerminate();
+                exit(EXIT_FAILURE);
             }
+            glfwMakeContextCurrent(window);
+            gladLoadGL(glfwGetProcAddress);
+            runUploadBenchmark(bounding_volumes, triangles);
+            glfwDestroyWindow(window);
+            glfwTerminate();
+            exit(EXIT_SUCCESS);
+        }
+
+        if (benchEdit)
+        {
+            if (buildSettings.sbvh)
+            {
+                fprintf(stderr, "--bench-edit needs --builder midpoint, the sbvh holds copies of split triangles\n");
+                exit(EXIT_FAILURE);
+            }
+            runEditBenchmark(bounding_volumes, triangles, buildSettings);
+            exit(EXIT_SUCCESS);
         }
-    }
-    mesh->mAABB.mMin = (mesh->mAABB.mMin - center) / maxExtent;
-    mesh->mAABB.mMax = (mesh->mAABB.mMax  - center) / maxExtent;
 
+        std::vector<LODLevel> lods;
+        if (lodLevels > 0 || benchLOD)
+            buildLODs(triangles, meshMin, meshMax, buildSettings, lodLevels > 0 ? lodLevels : 4, lods);
 
-    if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
-    {
-        printf("error loading the model sad");
-    }else {
-    printf("loaded the model happy");
+        if (benchLOD)
+        {
+            runLODBenchmark(bounding_volumes, triangles, lods, lodBias);
+            exit(EXIT_SUCCESS);
+        }
+
+        if (benchCompress)
+        {
+            runCompressBenchmark(bounding_volumes, triangles, renderWidth > 0 ? renderWidth : 512, renderHeight > 0 ? renderHeight : 512);
+            exit(EXIT_SUCCESS);
+        }
     }
 
+    // the viewer opens its window and compiles the shaders while the mesh loads and builds on another thread
+    LoadOptions loadOptions;
+    loadOptions.path = meshPath;
+    loadOptions.build = buildSettings;
+    loadOptions.lodLevels = lodLevels;
+    loadOptions.compressTriangles = compressTriangles;
+    MeshLoader loader;
+    loader.start(loadOptions);
+
+    std::vector<Triangle> triangles;
+    std::vector<BVHNode> bounding_volumes;
+    std::vector<PackedTriangle> packedTriangles;
+    std::vector<LODLevel> lods;
 
     glfwSetErrorCallback(error_callback);
  
@@ -332,82 +572,22 @@ int main(void)
  
     glfwMakeContextCurrent(window);
     gladLoadGL(glfwGetProcAddress);
-    glfwSwapInterval(1);
+    glfwSwapInterval(vsyncEnabled ? 1 : 0);
  
-    // NOTE: OpenGL error checks have been omitted for brevity
-    std::vector<Triangle> triangles;
-    std::vector<BVHNode> bounding_volumes;
-
-    triangles.reserve(mesh->mNumFaces);
-    bounding_volumes.reserve(500); // todo
-    //build triangles
-    for (unsigned int i = 0; i < mesh->mNumFaces; i++)
-    {
-        Triangle t;
-
-        aiFace& face = mesh->mFaces[i];
-        if (face.mNumIndices != 3)
-            continue;
-        unsigned int i0 = face.mIndices[0];
-        unsigned int i1 = face.mIndices[1];
-        unsigned int i2 = face.mIndices[2];
-        t.v0[0] = mesh->mVertices[i0].x;
-        t.v0[1] = mesh->mVertices[i0].y;
-        t.v0[2] = mesh->mVertices[i0].z;
-        t.v1[0] = mesh->mVertices[i1].x;
-        t.v1[1] = mesh->mVertices[i1].y;
-        t.v1[2] = mesh->mVertices[i1].z;
-        t.v2[0] = mesh->mVertices[i2].x;
-        t.v2[1] = mesh->mVertices[i2].y;
-        t.v2[2] = mesh->mVertices[i2].z;
-
-        // printf("%f\n", t.v0[0]);
-
-        aiVector3D p0 = mesh->mVertices[i0];
-        aiVector3D p1 = mesh->mVertices[i1];
-        aiVector3D p2 = mesh->mVertices[i2];
-
-        // edges
-        aiVector3D e1 = p1 - p0;
-        aiVector3D e2 = p2 - p0;
-
-        // face normal
-        aiVector3D normal = e1 ^ e2;  // cross product
-        normal.Normalize();
-        t.normal[0] = normal[0];
-        t.normal[1] = normal[1];
-        t.normal[2] = normal[2];
-
-        triangles.push_back(t);
-    }
-
-    //build bvh
-    printf("%d \n", buildBVHNode(bounding_volumes, triangles, 0, triangles.size(), mesh->mAABB.mMin, mesh->mAABB.mMax, 0, 0));
-
-    // Upload to buffers
-    GLuint triangleSSBO;
-    glGenBuffers(1, &triangleSSBO);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, triangleSSBO);
-    glBufferData(
-        GL_SHADER_STORAGE_BUFFER,
-        triangles.size() * sizeof(Triangle),
-        triangles.data(),
-        GL_STATIC_DRAW
-    );
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, triangleSSBO);
-
-    GLuint bvhSSBO;
-    glGenBuffers(1, &bvhSSBO);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, bvhSSBO);
-    glBufferData(
-        GL_SHADER_STORAGE_BUFFER,
-        bounding_volumes.size() * sizeof(BVHNode),
-        bounding_volumes.data(),
-        GL_STATIC_DRAW
-    );
-
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, bvhSSBO);
+    // filled by uploadBVH once the loader has something to show. everything goes through the staging ring,
+    // which needs gl 4.4 for glBufferStorage and falls back to glBufferSubData without it
+    DeviceBuffer triangleBuffer, bvhBuffer;
+    UploadRing uploadRing;
+    if (!uploadRing.create())
+        printf("no glBufferStorage, uploading with glBufferSubData\n");
+
+    // edits from the E key go through this once the full mesh is in, the node buffer only changes where it says
+    std::unique_ptr<IncrementalBVH> incremental;
  
+    // compiles while the loader thread works
+    GLuint program;
+    {
+    ScopedTimer timer("shader compile");
     std::string vertexShaderCode = LoadFile("C:/Users/oliox/Documents/Code/Mesh-Raytracing/src/shaders/vs.glsl");
     std::string fragmentShaderCode = LoadFile("C:/Users/oliox/Documents/Code/Mesh-Raytracing/src/shaders/fs.glsl");
 
@@ -424,20 +604,117 @@ int main(void)
     glCompileShader(fragment_shader);
     CheckShaderCompile(fragment_shader, "FRAGMENT");
  
-    const GLuint program = glCreateProgram();
+    program = glCreateProgram();
     glAttachShader(program, vertex_shader);
     glAttachShader(program, fragment_shader);
     glLinkProgram(program);
+    // drivers can finish compiling lazily, asking for the status makes the timer cover it
+    GLint linked;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    }
  
     const GLint mvp_location = glGetUniformLocation(program, "MVP");
+    const GLint overlay_location = glGetUniformLocation(program, "showOverlay");
+    const GLint traversal_location = glGetUniformLocation(program, "traversalMode");
+    const GLint view_location = glGetUniformLocation(program, "viewMode");
+    const GLint intersect_location = glGetUniformLocation(program, "intersectMode");
+    const GLint compressed_location = glGetUniformLocation(program, "compressedTriangles");
+    const GLint gpu_times_location = glGetUniformLocation(program, "gpuFrameTimes");
+    const GLint cpu_times_location = glGetUniformLocation(program, "cpuFrameTimes");
  
     glfwSetMouseButtonCallback(window, mouse_button_callback);
     glfwSetCursorPosCallback(window, cursor_position_callback);
     
-
+    GLuint emptyVAO;
+    glGenVertexArrays(1, &emptyVAO);
+
+    GpuTimer traceTimer;
+    traceTimer.init();
+    FrameHistory gpuHistory;
+    FrameHistory cpuHistory;
+    float unrolled[FrameHistory::SIZE];
+    int frameIndex = 0;
+    int shownLOD = 0; // level in the buffers, 0 is the full mesh
+    MeshLoader::Stage shownStage = MeshLoader::Loading;
+    double firstPixelMs = -1.0, fullQualityMs = -1.0;
+    double lastFrameStart = nowMs();
+    double lastTitleUpdate = 0.0;
 
     while (!glfwWindowShouldClose(window))
     {
+        // pick up whatever the loader finished since the last frame
+        MeshLoader::Stage stage = loader.stage();
+        if (stage == MeshLoader::Failed)
+        {
+            glfwDestroyWindow(window);
+            glfwTerminate();
+            exit(EXIT_FAILURE);
+        }
+        if (stage == MeshLoader::Preview && shownStage == MeshLoader::Loading)
+        {
+            ScopedTimer timer("preview upload");
+            const LoadedMesh& preview = loader.preview();
+            uploadBVH(uploadRing, bvhBuffer, triangleBuffer, preview.nodes, preview.triangles.data(), preview.triangles.size() * sizeof(Triangle), false);
+            shownStage = MeshLoader::Preview;
+        }
+        if (stage == MeshLoader::Full && shownStage != MeshLoader::Full)
+        {
+            LoadedMesh mesh = loader.takeFull();
+            bounding_volumes = std::move(mesh.nodes);
+            triangles = std::move(mesh.triangles);
+            packedTriangles = std::move(mesh.packedTriangles);
+            lods = std::move(mesh.lods);
+            compressTriangles = !packedTriangles.empty();
+            if (compressTriangles && !lods.empty())
+            {
+                printf("lods are float triangles only, drawing the full mesh\n");
+                lods.clear();
+            }
+
+            size_t uploadedBefore = uploadRing.bytesUploaded;
+            resetPeakResident();
+            size_t residentBefore = residentBytes();
+            double uploadStart = nowMs();
+            {
+            ScopedTimer timer("ssbo upload");
+            // only one copy of the triangles goes to the gpu, float at binding 0 or packed at binding 2
+            if (compressTriangles)
+                uploadBVH(uploadRing, bvhBuffer, triangleBuffer, bounding_volumes, packedTriangles.data(), packedTriangles.size() * sizeof(PackedTriangle), true);
+            else
+                uploadBVH(uploadRing, bvhBuffer, triangleBuffer, bounding_volumes, triangles.data(), triangles.size() * sizeof(Triangle), false);
+            // the copies out of the ring run on the gpu timeline, wait so the timer means something
+            glFinish();
+            }
+            double uploadMs = nowMs() - uploadStart;
+            size_t peak = peakResidentBytes();
+            printf("upload: %.2f MB in %.2f ms, %.2f GB/s, %.2f MB peak host memory on top, %.3f ms waiting on fences\n",
+                   (uploadRing.bytesUploaded - uploadedBefore) / 1e6, uploadMs,
+                   (uploadRing.bytesUploaded - uploadedBefore) / 1e6 / uploadMs, peak > residentBefore ? (peak - residentBefore) / 1e6 : 0.0,
+                   uploadRing.fenceWaitMs);
+            incremental = std::make_unique<IncrementalBVH>(bounding_volumes, triangles, buildSettings);
+            shownStage = MeshLoader::Full;
+            shownLOD = 0;
+
+            printStageTimings();
+            for (const StageTiming& s : stageTimings())
+                profileLog.stage(s);
+        }
+        if (shownStage == MeshLoader::Loading)
+        {
+            // nothing to trace yet
+            glClear(GL_COLOR_BUFFER_BIT);
+            glfwSwapBuffers(window);
+            glfwWaitEventsTimeout(0.01);
+            lastFrameStart = nowMs();
+            continue;
+        }
+
+        double frameStart = nowMs();
+        double cpuFrameMs = frameStart - lastFrameStart;
+        lastFrameStart = frameStart;
+        if (frameIndex > 0)
+            cpuHistory.push((float) cpuFrameMs);
+
         int width, height;
         glfwGetFramebufferSize(window, &width, &height);
         const float ratio = width / (float) height;
@@ -451,31 +728,136 @@ int main(void)
         // mat4x4_ortho(p, -ratio, ratio, -1.f, 1.f, 1.f, -1.f);
         // mat4x4_mul(mvp, p, m);
 
-        mat4x4 rotXmat, rotYmat, model;
-        mat4x4_identity(rotXmat);
-        mat4x4_identity(rotYmat);
-        mat4x4_identity(model);
-        mat4x4_identity(mvp);
-        mat4x4_rotate_X(rotXmat, rotXmat, rotX);
-        mat4x4_rotate_Y(rotYmat, rotYmat, rotY);
+        viewMatrix(mvp, rotX, rotY);
 
-        // combine them
-        mat4x4_mul(model, rotYmat, rotXmat);
+        // the level only changes with the window size, so it is swapped into the buffers rather than uploaded side by side
+        int lod = selectLOD(lods, pixelFootprint(mvp, width, height), lodBias);
+        if (lod != shownLOD)
+        {
+            std::span<const BVHNode> nodes = lod == 0 ? std::span<const BVHNode>(bounding_volumes) : lods[lod - 1].nodes;
+            std::span<const Triangle> tris = lod == 0 ? std::span<const Triangle>(triangles) : lods[lod - 1].triangles;
+            uploadBVH(uploadRing, bvhBuffer, triangleBuffer, nodes, tris.data(), tris.size_bytes(), false);
+            printf("lod %d: %zu triangles\n", lod, tris.size());
+            shownLOD = lod;
+        }
 
-        // create full MVP
-        mat4x4_mul(mvp, model, mvp);
+        if (editRequested && !incremental)
+            printf("edit: the full mesh is still building\n");
+        else if (editRequested && shownLOD != 0)
+            printf("edit: lod %d is showing, edits only go to the full mesh\n", shownLOD);
+        else if (editRequested && compressTriangles)
+            printf("edit: the mesh is packed, run without --compress-triangles to edit it\n");
+        else if (editRequested && buildSettings.sbvh)
+            printf("edit: the sbvh holds copies of split triangles, run with --builder midpoint to edit\n");
+        else if (editRequested)
+        {
+            const int EDIT_TRIANGLES = 512;
+            float center[3];
+            float distance = 0.005f;
+            if (pickEdit(bounding_volumes, triangles, mvp, center, distance))
+            {
+                for (int t : pushTriangles(triangles, center, EDIT_TRIANGLES, distance))
+                    incremental->markDirty(t);
+
+                double updateStart = nowMs();
+                BVHUpdate update = incremental->update();
+                double uploadStart = nowMs();
+                size_t bytes;
+                if (update.fullRebuild || update.nodesGrew)
+                {
+                    // the node buffer has to be reallocated anyway, send everything
+                    uploadBVH(uploadRing, bvhBuffer, triangleBuffer, bounding_volumes, triangles.data(), triangles.size() * sizeof(Triangle), false);
+                    bytes = bounding_volumes.size() * sizeof(BVHNode) + triangles.size() * sizeof(Triangle);
+                }
+                else
+                {
+                    bytes = uploadRanges(uploadRing, bvhBuffer, update.nodeRanges, sizeof(BVHNode), bounding_volumes.data())
+                          + uploadRanges(uploadRing, triangleBuffer, update.triangleRanges, sizeof(Triangle), triangles.data());
+                }
+                glFinish();
+                double uploadEnd = nowMs();
+                printf("edit: %d triangles, %d subtrees, %d nodes built%s, update %.3f ms, upload %.3f ms, %zu bytes\n",
+                       update.trianglesRebuilt, update.subtrees, update.nodesBuilt, update.fullRebuild ? " (full rebuild)" : "",
+                       uploadStart - updateStart, uploadEnd - uploadStart, bytes);
+            }
+            else
+                printf("edit: nothing under the middle of the screen\n");
+        }
+        editRequested = false;
  
         glUseProgram(program);
         glUniformMatrix4fv(mvp_location, 1, GL_FALSE, (const GLfloat*) &mvp);
-        GLuint emptyVAO;
-        glGenVertexArrays(1, &emptyVAO);
+        glUniform1i(overlay_location, showOverlay ? 1 : 0);
+        glUniform1i(traversal_location, stacklessTraversal ? 1 : 0);
+        glUniform1i(view_location, viewMode);
+        glUniform1i(intersect_location, watertightIntersect ? 1 : 0);
+        glUniform1i(compressed_location, compressTriangles && shownStage == MeshLoader::Full ? 1 : 0);
+        gpuHistory.unroll(unrolled);
+        glUniform1fv(gpu_times_location, FrameHistory::SIZE, unrolled);
+        cpuHistory.unroll(unrolled);
+        glUniform1fv(cpu_times_location, FrameHistory::SIZE, unrolled);
         glBindVertexArray(emptyVAO);
+
+        traceTimer.begin(frameIndex);
         glDrawArrays(GL_TRIANGLES, 0, 3);
+        traceTimer.end();
+        // results come back a few frames late, each is logged under the frame it timed
+        for (int i = 0; i < traceTimer.resolvedCount; i++)
+        {
+            const GpuSample & sample = traceTimer.resolved[i];
+            gpuHistory.push((float) sample.ms);
+            profileLog.gpuFrame(sample.frame, sample.ms);
+        }
+
+        if (frameIndex > 0)
+            profileLog.frame(frameIndex, cpuFrameMs);
+
+        // the graph has no text, so the numbers go in the title bar
+        if (frameStart - lastTitleUpdate > 500.0)
+        {
+            char title[256];
+            char lodLabel[32];
+            if (shownStage == MeshLoader::Preview)
+                snprintf(lodLabel, sizeof(lodLabel), "preview");
+            else
+                snprintf(lodLabel, sizeof(lodLabel), "lod %d", shownLOD);
+            float avgCpu = cpuHistory.average();
+            snprintf(title, sizeof(title), "Mesh Raytracing | trace %.3f ms (gpu) | frame %.2f ms | %.0f fps | vsync %s | %s | %s | %s",
+                     gpuHistory.average(), avgCpu, avgCpu > 0.0f ? 1000.0f / avgCpu : 0.0f, vsyncEnabled ? "on" : "off",
+                     stacklessTraversal ? "stackless" : "stack", watertightIntersect ? "watertight" : "fast", lodLabel);
+            glfwSetWindowTitle(window, title);
+            lastTitleUpdate = frameStart;
+        }
+        frameIndex++;
 
         glfwSwapBuffers(window);
+
+        // startup metrics, from program start to the first frame on screen with the preview and with the full bvh
+        if (firstPixelMs < 0.0 || (fullQualityMs < 0.0 && shownStage == MeshLoader::Full))
+        {
+            glFinish();
+            double ms = nowMs() - startMs;
+            if (firstPixelMs < 0.0)
+            {
+                firstPixelMs = ms;
+                printf("time to first pixel: %.1f ms\n", ms);
+                profileLog.stage({"time to first pixel", ms, 0});
+            }
+            if (fullQualityMs < 0.0 && shownStage == MeshLoader::Full)
+            {
+                fullQualityMs = ms;
+                printf("time to full quality: %.1f ms\n", ms);
+                profileLog.stage({"time to full quality", ms, 0});
+            }
+        }
         glfwPollEvents();
     }
  
+    traceTimer.destroy();
+    uploadRing.destroy();
+    triangleBuffer.destroy();
+    bvhBuffer.destroy();
+    profileLog.close();
     glfwDestroyWindow(window);
  
     glfwTerminate();
@@ -0,0 +1,116 @@
+#include "mesh.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+
+#include <assimp/Importer.hpp>      // C++ importer interface
+#include <assimp/postprocess.h>     // Post processing flags
+
+#include "profiling.h"
+
+bool loadMesh(const char* path, std::vector<Triangle> & triangles, aiVector3D & min, aiVector3D & max)
+{
+    Assimp::Importer importer;
+    const aiScene* scene;
+    {
+    ScopedTimer timer("import");
+    scene = importer.ReadFile(path, 
+                                            aiProcess_Triangulate | 
+                                            aiProcess_FlipUVs | 
+                                            aiProcess_GenNormals |
+                                            aiProcess_GenBoundingBoxes);
+    }
+
+    if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode || scene->mNumMeshes == 0)
+    {
+        printf("error loading the model sad: %s\n", importer.GetErrorString());
+        return false;
+    }
+    printf("loaded the model happy: %s\n", path);
+
+    aiMesh* mesh = scene->mMeshes[0]; // load first mesh
+    // normalize mesh
+    aiVector3D center = (mesh->mAABB.mMin + mesh->mAABB.mMax) * 0.5f;
+    aiVector3D extent = mesh->mAABB.mMax - mesh->mAABB.mMin;
+
+    float maxExtent = std::max(extent.x, std::max(extent.y, extent.z));
+    float scale = 1.0f / maxExtent;   // fits into [-0.5, 0.5]
+
+    {
+    ScopedTimer timer("normalize");
+    for (unsigned int m = 0; m < scene->mNumMeshes; ++m)
+    {
+        aiMesh* mesh = scene->mMeshes[m];
+
+        for (unsigned int v = 0; v < mesh->mNumVertices; ++v)
+        {
+            mesh->mVertices[v] -= center;
+            mesh->mVertices[v] *= scale;
+        }
+
+        // Optional: renormalize normals (safe practice)
+        if (mesh->HasNormals())
+        {
+            for (unsigned int v = 0; v < mesh->mNumVertices; ++v)
+            {
+                mesh->mNormals[v].Normalize();
+            }
+        }
+    }
+    mesh->mAABB.mMin = (mesh->mAABB.mMin - center) / maxExtent;
+    mesh->mAABB.mMax = (mesh->mAABB.mMax  - center) / maxExtent;
+    }
+
+
+    triangles.clear();
+    triangles.reserve(mesh->mNumFaces);
+    //build triangles
+    {
+    ScopedTimer timer("triangles");
+    for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+    {
+        Triangle t;
+
+        aiFace& face = mesh->mFaces[i];
+        if (face.mNumIndices != 3)
+            continue;
+        unsigned int i0 = face.mIndices[0];
+        unsigned int i1 = face.mIndices[1];
+        unsigned int i2 = face.mIndices[2];
+        t.v0[0] = mesh->mVertices[i0].x;
+        t.v0[1] = mesh->mVertices[i0].y;
+        t.v0[2] = mesh->mVertices[i0].z;
+        t.v1[0] = mesh->mVertices[i1].x;
+        t.v1[1] = mesh->mVertices[i1].y;
+        t.v1[2] = mesh->mVertices[i1].z;
+        t.v2[0] = mesh->mVertices[i2].x;
+        t.v2[1] = mesh->mVertices[i2].y;
+        t.v2[2] = mesh->mVertices[i2].z;
+
+        // printf("%f\n", t.v0[0]);
+
+        aiVector3D p0 = mesh->mVertices[i0];
+        aiVector3D p1 = mesh->mVertices[i1];
+        aiVector3D p2 = mesh->mVertices[i2];
+
+        // edges
+        aiVector3D e1 = p1 - p0;
+        aiVector3D e2 = p2 - p0;
+
+        // face normal
+        aiVector3D normal = e1 ^ e2;  // cross product
+        normal.Normalize();
+        t.normal[0] = normal[0];
+        t.normal[1] = normal[1];
+        t.normal[2] = normal[2];
+
+        setTriangleId(t, triangles.size());
+        triangles.push_back(t);
+    }
+    }
+
+    min = mesh->mAABB.mMin;
+    max = mesh->mAABB.mMax;
+    return true;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include "bvh.h"
+
+#include <vector>
+
+// imports the first mesh in the file, normalizes it to fit the unit cube around the origin
+// and converts its faces into triangles. min and max get the normalized bounds.
+// returns false if the import failed
+bool loadMesh(const char* path, std::vector<Triangle> & triangles, aiVector3D & min, aiVector3D & max);
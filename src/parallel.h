@@ -0,0 +1,28 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// calls fn(i) for every i in [0, count) from a pool of threads pulling indices off a shared counter.
+// threads <= 0 uses every hardware thread
+template <typename Fn>
+void parallelFor(int count, Fn fn, int threads = 0)
+{
+    if (threads <= 0)
+        threads = (int) std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min(threads, std::max(count, 1));
+
+    std::atomic<int> next{0};
+    auto worker = [&]() {
+        for (int i = next++; i < count; i = next++)
+            fn(i);
+    };
+    std::vector<std::thread> pool;
+    for (int t = 1; t < threads; t++)
+        pool.emplace_back(worker);
+    worker();
+    for (std::thread& t : pool)
+        t.join();
+}
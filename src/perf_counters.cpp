@@ -0,0 +1,102 @@
+#include "perf_counters.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+#endif
+
+const char* PerfCounters::name(int counter)
+{
+    switch (counter) {
+    case CacheReferences: return "cache refs";
+    case CacheMisses: return "cache misses";
+    case Instructions: return "instructions";
+    case Cycles: return "cycles";
+    }
+    return "?";
+}
+
+#ifdef __linux__
+
+bool PerfCounters::open()
+{
+    const uint64_t configs[COUNT] = {
+        PERF_COUNT_HW_CACHE_REFERENCES,
+        PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CPU_CYCLES,
+    };
+    available = true;
+    for (int i = 0; i < COUNT; i++) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = configs[i];
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fds[i] = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (fds[i] == -1)
+            available = false;
+    }
+    if (!available)
+        close();
+    return available;
+}
+
+void PerfCounters::start()
+{
+    for (int i = 0; i < COUNT; i++) {
+        values[i] = 0;
+        if (fds[i] != -1) {
+            ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+void PerfCounters::stop()
+{
+    for (int i = 0; i < COUNT; i++) {
+        if (fds[i] == -1)
+            continue;
+        ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+        uint64_t value = 0;
+        if (read(fds[i], &value, sizeof(value)) == sizeof(value))
+            values[i] = value;
+    }
+}
+
+void PerfCounters::close()
+{
+    for (int i = 0; i < COUNT; i++) {
+        if (fds[i] != -1)
+            ::close(fds[i]);
+        fds[i] = -1;
+    }
+}
+
+#else
+
+bool PerfCounters::open()
+{
+    return false;
+}
+
+void PerfCounters::start()
+{
+}
+
+void PerfCounters::stop()
+{
+}
+
+void PerfCounters::close()
+{
+}
+
+#endif
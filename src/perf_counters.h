@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+
+// hardware counters for the calling thread through perf_event_open (linux only).
+// when they can't be opened (other platforms, containers, perf_event_paranoid) available is false and everything reads 0
+struct PerfCounters {
+    enum Counter { CacheReferences, CacheMisses, Instructions, Cycles, COUNT };
+
+    int fds[COUNT] = {-1, -1, -1, -1};
+    uint64_t values[COUNT] = {};
+    bool available = false;
+
+    bool open();
+    void start();
+    void stop();
+    void close();
+
+    static const char* name(int counter);
+};
@@ -0,0 +1,227 @@
+#include "profiling.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <new>
+
+// allocation count hook. replacing the global operator new counts every vector growth,
+// string and node allocation without touching the code being measured
+static std::atomic<long> allocations{0};
+
+void* operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+long allocationCount()
+{
+    return allocations.load(std::memory_order_relaxed);
+}
+
+// reads one "Name:   123 kB" line out of /proc/self/status
+static size_t procStatusBytes(const char* field)
+{
+#ifdef __linux__
+    FILE* file = fopen("/proc/self/status", "r");
+    if (!file)
+        return 0;
+    char line[256];
+    size_t kb = 0;
+    size_t length = strlen(field);
+    while (fgets(line, sizeof(line), file)) {
+        if (strncmp(line, field, length) == 0 && line[length] == ':') {
+            kb = strtoull(line + length + 1, nullptr, 10);
+            break;
+        }
+    }
+    fclose(file);
+    return kb * 1024;
+#else
+    (void) field;
+    return 0;
+#endif
+}
+
+size_t residentBytes()
+{
+    return procStatusBytes("VmRSS");
+}
+
+size_t peakResidentBytes()
+{
+    return procStatusBytes("VmHWM");
+}
+
+bool resetPeakResident()
+{
+#ifdef __linux__
+    // 5 resets the peak resident size, see proc(5)
+    FILE* file = fopen("/proc/self/clear_refs", "w");
+    if (!file)
+        return false;
+    bool ok = fputs("5", file) >= 0;
+    return fclose(file) == 0 && ok;
+#else
+    return false;
+#endif
+}
+
+double nowMs()
+{
+    using clock = std::chrono::steady_clock;
+    static const clock::time_point origin = clock::now();
+    return std::chrono::duration<double, std::milli>(clock::now() - origin).count();
+}
+
+// the viewer times stages on its loader thread and the main thread at once
+static std::mutex stageMutex;
+
+std::vector<StageTiming>& stageTimings()
+{
+    static std::vector<StageTiming> timings;
+    return timings;
+}
+
+void printStageTimings()
+{
+    for (const StageTiming& s : stageTimings()) {
+        printf("%-16s %10.3f ms %10ld allocations\n", s.name.c_str(), s.ms, s.allocations);
+    }
+}
+
+ScopedTimer::ScopedTimer(const char* name) : name(name), start(nowMs()), startAllocations(allocationCount())
+{
+}
+
+ScopedTimer::~ScopedTimer()
+{
+    std::lock_guard<std::mutex> lock(stageMutex);
+    stageTimings().push_back({name, nowMs() - start, allocationCount() - startAllocations});
+}
+
+void GpuTimer::init()
+{
+    glGenQueries(QUERIES, queries);
+}
+
+void GpuTimer::begin(int frameIndex)
+{
+    // the result from QUERIES frames ago still hasn't come back, skip this frame rather than stall
+    timing = !pending[slot];
+    if (timing) {
+        issuedFrame[slot] = frameIndex;
+        glBeginQuery(GL_TIME_ELAPSED, queries[slot]);
+    }
+}
+
+void GpuTimer::end()
+{
+    if (timing) {
+        glEndQuery(GL_TIME_ELAPSED);
+        pending[slot] = true;
+    }
+
+    // oldest first, queries finish in the order they were issued. the one in this slot is the newest, unless
+    // this frame wasn't timed and it is still waiting from QUERIES frames ago
+    resolvedCount = 0;
+    int oldest = timing ? slot + 1 : slot;
+    for (int i = 0; i < QUERIES; i++) {
+        int prev = (oldest + i) % QUERIES;
+        if (!pending[prev])
+            continue;
+        GLint available = 0;
+        glGetQueryObjectiv(queries[prev], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            break;
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(queries[prev], GL_QUERY_RESULT, &ns);
+        resolved[resolvedCount++] = {issuedFrame[prev], ns / 1.0e6};
+        pending[prev] = false;
+    }
+    slot = (slot + 1) % QUERIES;
+}
+
+void GpuTimer::destroy()
+{
+    glDeleteQueries(QUERIES, queries);
+}
+
+void FrameHistory::push(float ms)
+{
+    samples[head] = ms;
+    head = (head + 1) % SIZE;
+    if (count < SIZE)
+        count++;
+}
+
+float FrameHistory::average() const
+{
+    if (count == 0)
+        return 0.0f;
+    float sum = 0.0f;
+    for (int i = 0; i < count; i++)
+        sum += samples[i];
+    return sum / count;
+}
+
+void FrameHistory::unroll(float* out) const
+{
+    for (int i = 0; i < SIZE; i++) {
+        out[i] = samples[(head + i) % SIZE];
+    }
+}
+
+bool ProfileLog::open(const char* path)
+{
+    file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Failed to open profile log: %s\n", path);
+        return false;
+    }
+    fprintf(file, "kind,name,frame,ms\n");
+    return true;
+}
+
+void ProfileLog::stage(const StageTiming& s)
+{
+    if (file)
+        fprintf(file, "stage,%s,,%.4f\n", s.name.c_str(), s.ms);
+}
+
+void ProfileLog::frame(int frameIndex, double cpuMs)
+{
+    if (!file)
+        return;
+    fprintf(file, "cpu_frame,,%d,%.4f\n", frameIndex, cpuMs);
+}
+
+void ProfileLog::gpuFrame(int frameIndex, double gpuMs)
+{
+    if (!file)
+        return;
+    fprintf(file, "gpu_trace,,%d,%.4f\n", frameIndex, gpuMs);
+}
+
+void ProfileLog::close()
+{
+    if (file)
+        fclose(file);
+    file = nullptr;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <glad/gl.h>
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+// wall clock in milliseconds since the first call
+double nowMs();
+
+struct StageTiming {
+    std::string name;
+    double ms;
+    long allocations; // heap allocations made while the stage ran
+};
+
+// every ScopedTimer that finished so far, in completion order. timers can finish on any thread,
+// but only read this once the other threads are done
+std::vector<StageTiming>& stageTimings();
+void printStageTimings();
+
+// number of calls to the global operator new so far, from every thread
+long allocationCount();
+
+// resident set size of the process and its high water mark, in bytes (linux only, 0 elsewhere)
+size_t residentBytes();
+size_t peakResidentBytes();
+// resets the high water mark to the current resident size so a peak can be measured around one step.
+// false where the kernel doesn't allow it, the peak then covers the whole run
+bool resetPeakResident();
+
+// records how long the enclosing scope took under the given name. the allocation count is process wide,
+// so stages running at the same time on different threads count each other's allocations
+struct ScopedTimer {
+    explicit ScopedTimer(const char* name);
+    ~ScopedTimer();
+
+    const char* name;
+    double start;
+    long startAllocations;
+};
+
+// GL_TIME_ELAPSED timing of one pass per frame.
+// A small ring of query objects is polled with GL_QUERY_RESULT_AVAILABLE and
+// results are read back a few frames late, so asking for them never stalls the
+// pipeline waiting on the GPU. If every query is still in flight the frame is
+// simply not timed. Each result carries the frame that issued it.
+struct GpuSample {
+    int frame;
+    double ms;
+};
+
+struct GpuTimer {
+    static const int QUERIES = 4;
+    GLuint queries[QUERIES] = {};
+    bool pending[QUERIES] = {};
+    int issuedFrame[QUERIES] = {}; // frame passed to begin() for each pending query
+    bool timing = false;           // this frame's pass is being timed
+    int slot = 0;
+    GpuSample resolved[QUERIES] = {}; // results end() picked up this frame, oldest first
+    int resolvedCount = 0;
+
+    void init();
+    void begin(int frameIndex);
+    // ends this frame's query and picks up any earlier ones that are ready
+    void end();
+    void destroy();
+};
+
+// fixed size history of the last N samples, oldest first when unrolled
+struct FrameHistory {
+    static const int SIZE = 128;
+    float samples[SIZE] = {};
+    int head = 0;
+    int count = 0;
+
+    void push(float ms);
+    float average() const;
+    // copies the samples out oldest first so they can be uploaded as a uniform
+    void unroll(float* out) const;
+};
+
+// csv with one row per measurement: kind,name,frame,ms
+struct ProfileLog {
+    FILE* file = nullptr;
+
+    bool open(const char* path);
+    void stage(const StageTiming& s);
+    void frame(int frameIndex, double cpuMs);
+    // logged as GpuTimer results come back, under the frame that issued them
+    void gpuFrame(int frameIndex, double gpuMs);
+    void close();
+};
@@ -0,0 +1,676 @@
+#include "query_server.h"
+
+#include "batch.h"
+#include "bvh_file.h"
+#include "compress.h"
+#include "mesh.h"
+#include "parallel.h"
+#include "profiling.h"
+#include "socket_io.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+
+namespace {
+
+// message types and their payloads, framed as in socket_io.h
+enum QueryMessageType : uint32_t {
+    MSG_INFO = 1, // server -> client on connect, QueryMeshInfo
+    MSG_QUERY,    // client -> server, QueryRequest then its QueryRays
+    MSG_HITS,     // server -> client, QueryResponse then one QueryHit per ray
+};
+
+struct QueryRequest {
+    uint32_t id;
+    uint32_t query; // Query
+    float tMax;
+    uint32_t count;
+};
+
+struct QueryResponse {
+    uint32_t id;
+    uint32_t count;
+};
+
+// a request bigger than this closes the connection instead of being buffered
+const size_t MAX_REQUEST_RAYS = 1 << 22;
+// answers are queued per client and sent as its socket takes them, so a client that stops reading only fills its
+// own queue. past this many unsent bytes it is dropped rather than buffered without end
+const size_t MAX_OUTBOX_BYTES = (size_t) 64 << 20;
+const double STATS_INTERVAL_MS = 5000.0;
+
+volatile sig_atomic_t stopRequested = 0;
+
+void requestStop(int)
+{
+    stopRequested = 1;
+}
+
+bool unixAddress(const char* path, sockaddr_un & addr)
+{
+    addr = {};
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return false;
+    }
+    strcpy(addr.sun_path, path);
+    return true;
+}
+
+// p in [0, 1] of values, which gets sorted
+double percentile(std::vector<double> & values, double p)
+{
+    if (values.empty())
+        return 0.0;
+    std::sort(values.begin(), values.end());
+    return values[(size_t) (p * (values.size() - 1) + 0.5)];
+}
+
+struct ClientConnection {
+    int fd = -1;
+    std::vector<char> inbox;
+
+    // framed answers waiting for the socket, appended by the trace thread and sent by the socket thread
+    std::mutex outboxMutex;
+    std::vector<char> outbox;
+    bool overflowed = false; // more than MAX_OUTBOX_BYTES unsent
+    bool dropped = false;    // the socket thread gave up on the client, nothing more is queued for it
+
+    ~ClientConnection()
+    {
+        if (fd >= 0)
+            close(fd);
+    }
+};
+
+struct PendingRequest {
+    // keeps the connection alive until the answer is queued, even if the client hung up in the meantime
+    std::shared_ptr<ClientConnection> client;
+    QueryRequest request;
+    std::vector<QueryRay> rays;
+    std::vector<QueryHit> hits;
+    double receivedMs;
+};
+
+// filled by the socket thread, drained a batch at a time by the trace thread
+struct RequestQueue {
+    std::mutex mutex;
+    std::condition_variable arrived;
+    std::deque<PendingRequest> requests;
+    size_t rays = 0;
+    bool stop = false;
+    int wakeFd = -1; // write end of a pipe the socket thread polls, poked when a batch of answers is queued
+};
+
+struct ServerStats {
+    long requests = 0;
+    long rays = 0;
+    long batches = 0;
+    std::vector<double> latencyMs;
+    double sinceMs = 0.0;
+};
+
+void printServerStats(ServerStats & stats, double nowMillis)
+{
+    double seconds = (nowMillis - stats.sinceMs) / 1000.0;
+    if (stats.requests > 0) {
+        printf("%8.0f requests/s %10.3f Mrays/s %8.0f rays/batch   latency p50 %.3f ms p99 %.3f ms\n", stats.requests / seconds,
+               stats.rays / seconds / 1e6, (double) stats.rays / stats.batches, percentile(stats.latencyMs, 0.5),
+               percentile(stats.latencyMs, 0.99));
+        fflush(stdout);
+    }
+    stats = ServerStats();
+    stats.sinceMs = nowMillis;
+}
+
+// takes requests off the queue in batches of up to batchRays rays, traces each batch on every thread and answers
+void traceRequests(const QueryServerOptions & options, const MappedBVH & bvh, RequestQueue & queue)
+{
+    KernelConfig closest;
+    KernelConfig any;
+    any.query = Query::AnyHit;
+    const TraceKernel<Triangle> kernels[2] = {selectKernel<Triangle>(closest), selectKernel<Triangle>(any)};
+    const double coalesceMs = options.coalesceUs / 1000.0;
+    const int CHUNK = 256;
+
+    // one entry per ray in the batch, so the threads split rays rather than requests
+    struct BatchRay {
+        const QueryRay* ray;
+        QueryHit* hit;
+        float tMax;
+        int kernel;
+    };
+    std::vector<PendingRequest> batch;
+    std::vector<BatchRay> batchRays;
+    ServerStats stats;
+    stats.sinceMs = nowMs();
+
+    for (;;) {
+        batch.clear();
+        {
+            std::unique_lock<std::mutex> lock(queue.mutex);
+            queue.arrived.wait_for(lock, std::chrono::milliseconds(500), [&] { return queue.stop || !queue.requests.empty(); });
+            if (queue.stop)
+                break;
+            // an idle server gives other clients a moment to add to the batch. under load the queue fills while
+            // the previous batch traces and there is no wait at all
+            if (!queue.requests.empty()) {
+                double deadline = queue.requests.front().receivedMs + coalesceMs;
+                while (!queue.stop && queue.rays < (size_t) options.batchRays && nowMs() < deadline)
+                    queue.arrived.wait_for(lock, std::chrono::microseconds((long) ((deadline - nowMs()) * 1000.0) + 1));
+            }
+            size_t rays = 0;
+            while (!queue.requests.empty() && (batch.empty() || rays + queue.requests.front().rays.size() <= (size_t) options.batchRays)) {
+                rays += queue.requests.front().rays.size();
+                batch.push_back(std::move(queue.requests.front()));
+                queue.requests.pop_front();
+            }
+            queue.rays -= rays;
+        }
+
+        if (!batch.empty()) {
+            batchRays.clear();
+            for (PendingRequest & pending : batch) {
+                pending.hits.resize(pending.rays.size());
+                int kernel = pending.request.query == (uint32_t) Query::AnyHit ? 1 : 0;
+                for (size_t i = 0; i < pending.rays.size(); i++)
+                    batchRays.push_back({&pending.rays[i], &pending.hits[i], pending.request.tMax, kernel});
+            }
+
+            int chunks = (int) ((batchRays.size() + CHUNK - 1) / CHUNK);
+            parallelFor(chunks, [&](int chunk) {
+                size_t end = std::min(batchRays.size(), (size_t) (chunk + 1) * CHUNK);
+                for (size_t i = (size_t) chunk * CHUNK; i < end; i++) {
+                    const BatchRay & r = batchRays[i];
+                    Ray ray;
+                    setupRay(ray, r.ray->origin, r.ray->direction);
+                    HitInfo hit = kernels[r.kernel](bvh.nodes, bvh.triangles, ray, r.tMax, nullptr);
+                    r.hit->t = hit.t;
+                    r.hit->tri = hit.tri == -1 ? -1 : triangleId(bvh.triangles[hit.tri]);
+                }
+            }, options.threads);
+
+            // the socket thread sends them, a client that is slow to read never holds up the next batch
+            for (PendingRequest & pending : batch) {
+                QueryResponse response = {pending.request.id, (uint32_t) pending.hits.size()};
+                ClientConnection & client = *pending.client;
+                {
+                    std::lock_guard<std::mutex> lock(client.outboxMutex);
+                    if (!client.dropped) {
+                        appendMessage(client.outbox, MSG_HITS, &response, sizeof(response), pending.hits.data(),
+                                      pending.hits.size() * sizeof(QueryHit));
+                        if (client.outbox.size() > MAX_OUTBOX_BYTES)
+                            client.overflowed = true;
+                    }
+                }
+                stats.latencyMs.push_back(nowMs() - pending.receivedMs);
+                stats.rays += pending.rays.size();
+            }
+            stats.requests += batch.size();
+            stats.batches++;
+            // a full pipe already has a wakeup in it
+            char wake = 0;
+            if (write(queue.wakeFd, &wake, 1) < 0 && errno != EAGAIN)
+                perror("query server wakeup");
+        }
+
+        double now = nowMs();
+        if (now - stats.sinceMs > STATS_INTERVAL_MS)
+            printServerStats(stats, now);
+    }
+    printServerStats(stats, nowMs());
+}
+
+// sends as much of the client's outbox as the socket takes without blocking. false once the client is gone or
+// has let too many answers pile up
+bool flushClient(ClientConnection & client)
+{
+    std::lock_guard<std::mutex> lock(client.outboxMutex);
+    if (client.overflowed) {
+        fprintf(stderr, "dropping a client with %zu MB of answers it hasn't read\n", client.outbox.size() >> 20);
+        return false;
+    }
+    size_t sent = 0;
+    bool ok = true;
+    while (ok && sent < client.outbox.size()) {
+        ssize_t n = send(client.fd, client.outbox.data() + sent, client.outbox.size() - sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n > 0)
+            sent += n;
+        else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        else if (n == 0 || errno != EINTR)
+            ok = false;
+    }
+    client.outbox.erase(client.outbox.begin(), client.outbox.begin() + sent);
+    return ok;
+}
+
+bool hasOutput(ClientConnection & client)
+{
+    std::lock_guard<std::mutex> lock(client.outboxMutex);
+    return !client.outbox.empty();
+}
+
+// reads whatever the socket has and queues every complete request. false once the client is gone or sent garbage
+bool readClient(const std::shared_ptr<ClientConnection> & client, RequestQueue & queue)
+{
+    char buffer[1 << 16];
+    for (;;) {
+        ssize_t got = recv(client->fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (got > 0) {
+            client->inbox.insert(client->inbox.end(), buffer, buffer + got);
+            continue;
+        }
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        return false;
+    }
+
+    double receivedMs = nowMs();
+    std::vector<PendingRequest> arrived;
+    size_t offset = 0;
+    while (client->inbox.size() - offset >= sizeof(MessageHeader)) {
+        MessageHeader header;
+        memcpy(&header, client->inbox.data() + offset, sizeof(header));
+        if (header.type != MSG_QUERY || header.size < sizeof(QueryRequest) || header.size > sizeof(QueryRequest) + MAX_REQUEST_RAYS * sizeof(QueryRay))
+            return false;
+        if (client->inbox.size() - offset - sizeof(header) < header.size)
+            break;
+
+        const char* payload = client->inbox.data() + offset + sizeof(header);
+        PendingRequest pending;
+        pending.client = client;
+        memcpy(&pending.request, payload, sizeof(pending.request));
+        if (header.size != sizeof(QueryRequest) + (size_t) pending.request.count * sizeof(QueryRay))
+            return false;
+        pending.rays.resize(pending.request.count);
+        memcpy(pending.rays.data(), payload + sizeof(QueryRequest), pending.rays.size() * sizeof(QueryRay));
+        pending.receivedMs = receivedMs;
+        arrived.push_back(std::move(pending));
+        offset += sizeof(header) + header.size;
+    }
+    client->inbox.erase(client->inbox.begin(), client->inbox.begin() + offset);
+
+    if (!arrived.empty()) {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        for (PendingRequest & pending : arrived) {
+            queue.rays += pending.rays.size();
+            queue.requests.push_back(std::move(pending));
+        }
+        queue.arrived.notify_one();
+    }
+    return true;
+}
+
+}
+
+int runQueryServer(const QueryServerOptions & options)
+{
+    // build once, or map what an earlier run or the coordinator saved
+    std::string bvhPath = options.bvhPath;
+    if (bvhPath.empty() && options.mesh)
+        bvhPath = options.outDir + "/" + meshName(options.mesh) + ".bvh";
+    if (options.mesh) {
+        std::vector<Triangle> triangles;
+        std::vector<BVHNode> nodes;
+        aiVector3D min, max;
+        if (!loadMesh(options.mesh, triangles, min, max))
+            return EXIT_FAILURE;
+        buildAccelerationStructure(nodes, triangles, min, max, options.build);
+        {
+            ScopedTimer timer("bvh save");
+            if (!saveBVHFile(bvhPath.c_str(), nodes, triangles))
+                return EXIT_FAILURE;
+        }
+        printStageTimings();
+    } else if (bvhPath.empty()) {
+        fprintf(stderr, "the query server needs a --mesh to build or a prebuilt --bvh\n");
+        return EXIT_FAILURE;
+    }
+
+    MappedBVH bvh;
+    if (!bvh.open(bvhPath.c_str()))
+        return EXIT_FAILURE;
+
+    QueryMeshInfo info = {};
+    info.triangles = bvh.triangles.size();
+    info.nodes = bvh.nodes.size();
+    memcpy(info.boundsMin, bvh.nodes[0].boundsMin, sizeof(info.boundsMin));
+    memcpy(info.boundsMax, bvh.nodes[0].boundsMax, sizeof(info.boundsMax));
+    snprintf(info.bvhPath, sizeof(info.bvhPath), "%s", bvhPath.c_str());
+
+    sockaddr_un addr;
+    if (!unixAddress(options.socketPath.c_str(), addr))
+        return EXIT_FAILURE;
+    // a socket file left by a server that didn't exit cleanly would make bind fail
+    unlink(options.socketPath.c_str());
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0 || bind(listenFd, (sockaddr*) &addr, sizeof(addr)) != 0 || listen(listenFd, 64) != 0) {
+        perror("query server socket");
+        return EXIT_FAILURE;
+    }
+
+    struct sigaction action = {};
+    action.sa_handler = requestStop;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    printf("%s: %zu triangles, %zu nodes mapped from %s, serving on %s\n", options.mesh ? options.mesh : bvhPath.c_str(),
+           bvh.triangles.size(), bvh.nodes.size(), bvhPath.c_str(), options.socketPath.c_str());
+    fflush(stdout);
+
+    // the trace thread pokes this when it has queued answers, so the poll below wakes up to send them
+    int wakePipe[2];
+    if (pipe(wakePipe) != 0) {
+        perror("query server pipe");
+        close(listenFd);
+        return EXIT_FAILURE;
+    }
+    for (int fd : wakePipe)
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    RequestQueue queue;
+    queue.wakeFd = wakePipe[1];
+    std::thread tracer(traceRequests, std::cref(options), std::cref(bvh), std::ref(queue));
+
+    std::vector<std::shared_ptr<ClientConnection>> clients;
+    auto dropClient = [&](size_t index) {
+        ClientConnection & client = *clients[index];
+        {
+            std::lock_guard<std::mutex> lock(client.outboxMutex);
+            client.dropped = true;
+            client.outbox.clear();
+        }
+        // no more reads or sends, the fd itself closes once the last queued request for it is traced
+        shutdown(client.fd, SHUT_RDWR);
+        clients.erase(clients.begin() + index);
+    };
+
+    const size_t FIRST_CLIENT = 2;
+    while (!stopRequested) {
+        std::vector<pollfd> fds;
+        fds.push_back({listenFd, POLLIN, 0});
+        fds.push_back({wakePipe[0], POLLIN, 0});
+        for (auto & client : clients)
+            fds.push_back({client->fd, (short) (hasOutput(*client) ? POLLIN | POLLOUT : POLLIN), 0});
+        if (poll(fds.data(), fds.size(), 500) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            break;
+        }
+
+        if (fds[1].revents & POLLIN) {
+            char drain[256];
+            while (read(wakePipe[0], drain, sizeof(drain)) > 0) {
+            }
+        }
+
+        for (size_t i = fds.size() - 1; i >= FIRST_CLIENT; i--) {
+            if ((fds[i].revents & ~POLLOUT) && !readClient(clients[i - FIRST_CLIENT], queue))
+                dropClient(i - FIRST_CLIENT);
+        }
+        // answers queued since the last poll go out now rather than a poll later, whatever is left waits for POLLOUT
+        for (size_t i = clients.size(); i-- > 0;) {
+            if (!flushClient(*clients[i]))
+                dropClient(i);
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(listenFd, nullptr, nullptr);
+            if (fd < 0)
+                continue;
+            auto client = std::make_shared<ClientConnection>();
+            client->fd = fd;
+            appendMessage(client->outbox, MSG_INFO, &info, sizeof(info));
+            if (flushClient(*client))
+                clients.push_back(client);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.stop = true;
+        queue.arrived.notify_one();
+    }
+    tracer.join();
+    clients.clear();
+    close(wakePipe[0]);
+    close(wakePipe[1]);
+    close(listenFd);
+    unlink(options.socketPath.c_str());
+    return EXIT_SUCCESS;
+}
+
+bool QueryClient::connect(const char* socketPath)
+{
+    close();
+    sockaddr_un addr;
+    if (!unixAddress(socketPath, addr))
+        return false;
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || ::connect(fd, (sockaddr*) &addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "Failed to connect to query server %s\n", socketPath);
+        close();
+        return false;
+    }
+    MessageHeader header;
+    if (!recvAll(fd, &header, sizeof(header)) || header.type != MSG_INFO || header.size != sizeof(info) || !recvAll(fd, &info, sizeof(info))) {
+        fprintf(stderr, "query server did not send its mesh info\n");
+        close();
+        return false;
+    }
+    info.bvhPath[sizeof(info.bvhPath) - 1] = '\0';
+    return true;
+}
+
+void QueryClient::close()
+{
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+}
+
+bool QueryClient::submit(uint32_t id, std::span<const QueryRay> rays, Query query, float tMax)
+{
+    QueryRequest request = {id, (uint32_t) query, tMax, (uint32_t) rays.size()};
+    return sendMessage(fd, MSG_QUERY, &request, sizeof(request), rays.data(), rays.size_bytes());
+}
+
+bool QueryClient::receive(uint32_t & id, std::vector<QueryHit> & hits)
+{
+    MessageHeader header;
+    QueryResponse response;
+    if (!recvAll(fd, &header, sizeof(header)) || header.type != MSG_HITS || header.size < sizeof(response)
+        || !recvAll(fd, &response, sizeof(response)) || header.size != sizeof(response) + (size_t) response.count * sizeof(QueryHit))
+        return false;
+    id = response.id;
+    hits.resize(response.count);
+    return recvAll(fd, hits.data(), hits.size() * sizeof(QueryHit));
+}
+
+bool QueryClient::trace(std::span<const QueryRay> rays, std::vector<QueryHit> & hits, Query query, float tMax)
+{
+    uint32_t id;
+    return submit(0, rays, query, tMax) && receive(id, hits);
+}
+
+int runQueryBenchmark(const QueryBenchmarkOptions & options)
+{
+    QueryClient probe;
+    if (!probe.connect(options.socketPath.c_str()))
+        return EXIT_FAILURE;
+    const QueryMeshInfo info = probe.info;
+    probe.close();
+    printf("%lld triangles, %lld nodes served from %s, %d rays per request, %d requests in flight per client\n",
+           (long long) info.triangles, (long long) info.nodes, info.bvhPath, options.raysPerRequest, options.inFlight);
+
+    std::vector<int> counts;
+    for (int n = 1; n < options.clients; n *= 2)
+        counts.push_back(n);
+    counts.push_back(std::max(1, options.clients));
+
+    printf("%8s %12s %12s %8s %10s %10s\n", "clients", "requests/s", "Mrays/s", "hits", "p50 ms", "p99 ms");
+    int exitCode = EXIT_SUCCESS;
+    for (int clientCount : counts) {
+        struct ClientResult {
+            std::vector<double> latencyMs;
+            long hits = 0;
+            bool ok = true;
+        };
+        std::vector<ClientResult> results(clientCount);
+
+        auto runClient = [&](int c) {
+            ClientResult & result = results[c];
+            QueryClient client;
+            if (!client.connect(options.socketPath.c_str())) {
+                result.ok = false;
+                return;
+            }
+
+            // from a sphere around the bounds towards random points inside them, so most rays hit something
+            std::mt19937 rng(c + 1);
+            std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+            float center[3], radius = 0.0f;
+            for (int a = 0; a < 3; a++) {
+                center[a] = 0.5f * (info.boundsMin[a] + info.boundsMax[a]);
+                radius += (info.boundsMax[a] - info.boundsMin[a]) * (info.boundsMax[a] - info.boundsMin[a]);
+            }
+            radius = sqrtf(radius);
+            std::vector<QueryRay> rays(options.raysPerRequest);
+            auto fillRays = [&]() {
+                for (QueryRay & ray : rays) {
+                    float z = 2.0f * uniform(rng) - 1.0f;
+                    float phi = 6.2831853f * uniform(rng);
+                    float r = sqrtf(std::max(0.0f, 1.0f - z * z));
+                    float onSphere[3] = {r * cosf(phi), r * sinf(phi), z};
+                    float length = 0.0f;
+                    for (int a = 0; a < 3; a++) {
+                        ray.origin[a] = center[a] + radius * onSphere[a];
+                        float target = info.boundsMin[a] + uniform(rng) * (info.boundsMax[a] - info.boundsMin[a]);
+                        ray.direction[a] = target - ray.origin[a];
+                        length += ray.direction[a] * ray.direction[a];
+                    }
+                    length = sqrtf(length);
+                    for (int a = 0; a < 3; a++)
+                        ray.direction[a] /= length;
+                }
+            };
+
+            // answers come back in order, so the send times queue up the same way
+            std::deque<double> sentMs;
+            std::vector<QueryHit> hits;
+            int sent = 0, received = 0;
+            while (received < options.requests) {
+                while (sent < options.requests && sent - received < std::max(1, options.inFlight)) {
+                    fillRays();
+                    sentMs.push_back(nowMs());
+                    if (!client.submit(sent++, rays)) {
+                        result.ok = false;
+                        return;
+                    }
+                }
+                uint32_t id;
+                if (!client.receive(id, hits) || id != (uint32_t) received) {
+                    result.ok = false;
+                    return;
+                }
+                result.latencyMs.push_back(nowMs() - sentMs.front());
+                sentMs.pop_front();
+                received++;
+                for (const QueryHit & hit : hits)
+                    result.hits += hit.tri != -1;
+            }
+        };
+
+        double start = nowMs();
+        std::vector<std::thread> threads;
+        for (int c = 0; c < clientCount; c++)
+            threads.emplace_back(runClient, c);
+        for (std::thread & t : threads)
+            t.join();
+        double seconds = (nowMs() - start) / 1000.0;
+
+        std::vector<double> latencyMs;
+        long hits = 0;
+        for (const ClientResult & result : results) {
+            if (!result.ok)
+                exitCode = EXIT_FAILURE;
+            latencyMs.insert(latencyMs.end(), result.latencyMs.begin(), result.latencyMs.end());
+            hits += result.hits;
+        }
+        if (exitCode != EXIT_SUCCESS) {
+            fprintf(stderr, "a client lost its connection to the server\n");
+            break;
+        }
+        double requests = (double) latencyMs.size();
+        double rays = requests * options.raysPerRequest;
+        printf("%8d %12.0f %12.3f %7.1f%% %10.3f %10.3f\n", clientCount, requests / seconds, rays / seconds / 1e6,
+               rays > 0 ? 100.0 * hits / rays : 0.0, percentile(latencyMs, 0.5), percentile(latencyMs, 0.99));
+    }
+    return exitCode;
+}
+
+#else
+
+int runQueryServer(const QueryServerOptions &)
+{
+    fprintf(stderr, "The query server is only supported on POSIX systems\n");
+    return EXIT_FAILURE;
+}
+
+bool QueryClient::connect(const char*)
+{
+    return false;
+}
+
+void QueryClient::close()
+{
+}
+
+bool QueryClient::submit(uint32_t, std::span<const QueryRay>, Query, float)
+{
+    return false;
+}
+
+bool QueryClient::receive(uint32_t &, std::vector<QueryHit> &)
+{
+    return false;
+}
+
+bool QueryClient::trace(std::span<const QueryRay>, std::vector<QueryHit> &, Query, float)
+{
+    return false;
+}
+
+int runQueryBenchmark(const QueryBenchmarkOptions &)
+{
+    fprintf(stderr, "The query server is only supported on POSIX systems\n");
+    return EXIT_FAILURE;
+}
+
+#endif
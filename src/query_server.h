@@ -0,0 +1,89 @@
+#pragma once
+
+#include "bvh.h"
+#include "kernels.h"
+
+#include <stdint.h>
+
+#include <span>
+#include <string>
+#include <vector>
+
+// ray casts against a resident bvh for other processes (picking, visibility, measuring). the server maps a file
+// from saveBVHFile read only, so any number of servers and workers on the same file share one copy of its pages,
+// and answers batches of rays sent over a unix socket. requests from every client are queued as they arrive and
+// coalesced into one large batch (up to batchRays, or whatever came in within coalesceUs of the oldest) that is
+// traced on every thread at once, so many clients sending a few rays each still keep all the cores busy. clients
+// can pipeline, sending more requests before the answers come back; each client's answers come back in the order
+// it sent the requests
+
+struct QueryServerOptions {
+    const char* mesh = nullptr;                  // built once and saved to bvhPath. without one, bvhPath must already exist
+    std::string bvhPath;                         // defaults to <outDir>/<mesh name>.bvh
+    std::string outDir = ".";
+    std::string socketPath = "/tmp/mesh_rt.sock";
+    int threads = 0;                             // tracing threads, 0 for every hardware thread
+    int batchRays = 16384;                       // most rays traced together
+    double coalesceUs = 100.0;                   // how long an idle server waits for more requests to fill a batch
+    BuildSettings build;
+};
+
+// serves until SIGINT or SIGTERM, printing requests/sec, rays/sec, rays per batch and p50/p99 latency (receipt
+// to the answer being queued for sending) every few seconds. returns the process exit code
+int runQueryServer(const QueryServerOptions & options);
+
+struct QueryRay {
+    float origin[3];
+    float direction[3];
+};
+
+struct QueryHit {
+    float t;     // tMax on a miss
+    int32_t tri; // triangle id in the source mesh, -1 on a miss
+};
+
+// what the server says when a client connects
+struct QueryMeshInfo {
+    int64_t triangles;
+    int64_t nodes;
+    float boundsMin[3];
+    float boundsMax[3];
+    char bvhPath[1024]; // the mapped file, for a client on the same machine that wants to trace some rays itself
+};
+
+class QueryClient {
+public:
+    QueryClient() = default;
+    QueryClient(const QueryClient&) = delete;
+    QueryClient& operator=(const QueryClient&) = delete;
+    ~QueryClient() { close(); }
+
+    // connects and reads info
+    bool connect(const char* socketPath);
+    void close();
+
+    // sends a request without waiting for the answer. any hit stops at the first triangle closer than tMax
+    bool submit(uint32_t id, std::span<const QueryRay> rays, Query query = Query::ClosestHit, float tMax = 1e30f);
+    // waits for the answer to the oldest request still out
+    bool receive(uint32_t & id, std::vector<QueryHit> & hits);
+    // submit and receive in one, for a client with nothing else in flight
+    bool trace(std::span<const QueryRay> rays, std::vector<QueryHit> & hits, Query query = Query::ClosestHit, float tMax = 1e30f);
+
+    QueryMeshInfo info = {};
+
+private:
+    int fd = -1;
+};
+
+struct QueryBenchmarkOptions {
+    std::string socketPath = "/tmp/mesh_rt.sock";
+    int clients = 8;          // the most concurrent clients, the benchmark runs 1, 2, 4 ... up to this many
+    int raysPerRequest = 64;
+    int requests = 2000;      // per client
+    int inFlight = 4;         // requests each client keeps sent and unanswered
+};
+
+// load generator against a running server: each client is a thread with its own connection sending rays from
+// around the mesh bounds at random points inside them. prints requests/sec, rays/sec, hit rate and the p50/p99
+// round trip per client count. returns the process exit code
+int runQueryBenchmark(const QueryBenchmarkOptions & options);
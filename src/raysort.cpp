@@ -0,0 +1,225 @@
+#include "raysort.h"
+
+#include "bench.h"
+#include "kernels.h"
+#include "parallel.h"
+#include "perf_counters.h"
+#include "profiling.h"
+
+#include <math.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <random>
+
+namespace {
+
+const int MORTON_BITS = 10;
+const int INDEX_BITS = 31;
+
+// spreads the low 10 bits of v out to every third bit
+uint32_t expandBits(uint32_t v)
+{
+    v = (v | (v << 16)) & 0x030000ff;
+    v = (v | (v << 8)) & 0x0300f00f;
+    v = (v | (v << 4)) & 0x030c30c3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+}
+
+const char* rayOrderName(RayOrder order)
+{
+    switch (order) {
+    case RayOrder::Submission: return "submission";
+    case RayOrder::Origin: return "origin";
+    case RayOrder::OctantOrigin: return "octant+origin";
+    }
+    return "?";
+}
+
+RayBatch::RayBatch(const BVHNode & root)
+{
+    const float cells = (float) ((1 << MORTON_BITS) - 1);
+    for (int a = 0; a < 3; a++) {
+        sceneMin[a] = root.boundsMin[a];
+        float extent = root.boundsMax[a] - root.boundsMin[a];
+        cellScale[a] = extent > 0.0f ? cells / extent : 0.0f;
+    }
+}
+
+void RayBatch::push(const float* origin, const float* direction, int id)
+{
+    QueuedRay ray;
+    for (int a = 0; a < 3; a++) {
+        ray.origin[a] = origin[a];
+        ray.direction[a] = direction[a];
+    }
+    ray.id = id;
+    rays.push_back(ray);
+}
+
+uint64_t RayBatch::sortKey(const QueuedRay & ray, RayOrder order) const
+{
+    const float cells = (float) ((1 << MORTON_BITS) - 1);
+    uint32_t morton = 0;
+    for (int a = 0; a < 3; a++) {
+        // origins off the end of the box (a bounce leaving the mesh) share the edge cells
+        float cell = std::clamp((ray.origin[a] - sceneMin[a]) * cellScale[a], 0.0f, cells);
+        morton |= expandBits((uint32_t) cell) << (2 - a);
+    }
+    uint64_t key = morton;
+    if (order == RayOrder::OctantOrigin) {
+        uint32_t octant = (ray.direction[0] < 0.0f) | (ray.direction[1] < 0.0f) << 1 | (ray.direction[2] < 0.0f) << 2;
+        key |= (uint64_t) octant << (3 * MORTON_BITS);
+    }
+    return key;
+}
+
+void RayBatch::sortRays(RayOrder order)
+{
+    double start = nowMs();
+    keys.resize(rays.size());
+    for (size_t i = 0; i < rays.size(); i++)
+        keys[i] = (order == RayOrder::Submission ? 0 : sortKey(rays[i], order) << INDEX_BITS) | i;
+    if (order != RayOrder::Submission)
+        std::sort(keys.begin(), keys.end());
+    sortMs = nowMs() - start;
+}
+
+template <typename Fn>
+void RayBatch::forEachSorted(Fn fn, int threads)
+{
+    const uint64_t INDEX_MASK = (1ull << INDEX_BITS) - 1;
+    const int CHUNK = 256;
+
+    // chunks of consecutive sorted rays per thread, so each thread keeps the coherence the sort bought
+    int chunks = (int) ((rays.size() + CHUNK - 1) / CHUNK);
+    parallelFor(chunks, [&](int chunk) {
+        size_t end = std::min(rays.size(), (size_t) (chunk + 1) * CHUNK);
+        for (size_t k = (size_t) chunk * CHUNK; k < end; k++)
+            fn(rays[keys[k] & INDEX_MASK]);
+    }, threads);
+}
+
+void RayBatch::trace(std::span<const BVHNode> nodes, std::span<const Triangle> triangles, RayOrder order, std::span<HitInfo> hits, int threads)
+{
+    KernelConfig config;
+    TraceKernel<Triangle> kernel = selectKernel<Triangle>(config);
+    sortRays(order);
+    forEachSorted([&](const QueuedRay & ray) {
+        Ray r;
+        setupRay(r, ray.origin, ray.direction);
+        hits[ray.id] = kernel(nodes, triangles, r, 1e30f, nullptr);
+    }, threads);
+}
+
+void RayBatch::traceOcclusion(std::span<const BVHNode> nodes, std::span<const Triangle> triangles, RayOrder order, float tMax,
+                              std::span<uint8_t> occluded, int threads)
+{
+    KernelConfig config;
+    config.query = Query::AnyHit;
+    TraceKernel<Triangle> kernel = selectKernel<Triangle>(config);
+    sortRays(order);
+    forEachSorted([&](const QueuedRay & ray) {
+        Ray r;
+        setupRay(r, ray.origin, ray.direction);
+        occluded[ray.id] = kernel(nodes, triangles, r, tMax, nullptr).tri != -1;
+    }, threads);
+}
+
+void cosineSampleHemisphere(const float* n, float u1, float u2, float* dir)
+{
+    // orthonormal basis around n, Duff et al. 2017
+    float sign = copysignf(1.0f, n[2]);
+    float a = -1.0f / (sign + n[2]);
+    float b = n[0] * n[1] * a;
+    float t[3] = {1.0f + sign * n[0] * n[0] * a, sign * b, -sign * n[0]};
+    float s[3] = {b, sign + n[1] * n[1] * a, -n[1]};
+
+    float r = sqrtf(u1);
+    float phi = 6.2831853f * u2;
+    float x = r * cosf(phi);
+    float y = r * sinf(phi);
+    float z = sqrtf(std::max(0.0f, 1.0f - u1));
+    for (int i = 0; i < 3; i++)
+        dir[i] = x * t[i] + y * s[i] + z * n[i];
+}
+
+void runRaySortBenchmark(const std::vector<BVHNode> & nodes, const std::vector<Triangle> & triangles, int width, int height)
+{
+    const int SAMPLES = 4;
+    const float OFFSET = 1e-4f; // off the surface so a bounce doesn't hit the triangle it leaves
+    const std::vector<std::pair<float, float>> views = benchmarkViews(2);
+
+    // primary hits in pixel order, then SAMPLES random directions off each, the order a shading loop makes them in
+    RayBatch batch(nodes[0]);
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    int id = 0;
+    for (auto [rotX, rotY] : views) {
+        mat4x4 mvp;
+        viewMatrix(mvp, rotX, rotY);
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                vec3 ro, rd;
+                primaryRay(mvp, (x + 0.5f) / width, (y + 0.5f) / height, ro, rd);
+                HitInfo hit = closestHitFromBVHStackless(nodes, triangles, ro, rd);
+                if (hit.tri == -1)
+                    continue;
+                vec3 n, origin;
+                vec3_norm(n, triangles[hit.tri].normal);
+                if (vec3_mul_inner(n, rd) > 0.0f)
+                    vec3_scale(n, n, -1.0f);
+                for (int a = 0; a < 3; a++)
+                    origin[a] = ro[a] + hit.t * rd[a] + OFFSET * n[a];
+                for (int s = 0; s < SAMPLES; s++) {
+                    float dir[3];
+                    cosineSampleHemisphere(n, uniform(rng), uniform(rng), dir);
+                    batch.push(origin, dir, id++);
+                }
+            }
+        }
+    }
+    printf("%zu secondary rays, %d per primary hit\n", batch.size(), SAMPLES);
+
+    PerfCounters counters;
+    if (!counters.open())
+        printf("perf counters unavailable, only timing rays\n");
+
+    printf("%-14s %10s %12s", "order", "sort ms", "Mrays/s");
+    if (counters.available) {
+        for (int c = 0; c < PerfCounters::COUNT; c++)
+            printf(" %14s", PerfCounters::name(c));
+        printf(" %12s", "miss/ray");
+    }
+    printf(" %10s %12s\n", "hits", "mismatches");
+
+    std::vector<HitInfo> reference(batch.size());
+    std::vector<HitInfo> hits(batch.size());
+    for (RayOrder order : {RayOrder::Submission, RayOrder::Origin, RayOrder::OctantOrigin}) {
+        std::span<HitInfo> out = order == RayOrder::Submission ? std::span<HitInfo>(reference) : std::span<HitInfo>(hits);
+
+        // single threaded so the counters, which only see the calling thread, see every ray
+        double start = nowMs();
+        counters.start();
+        batch.trace(nodes, triangles, order, out, 1);
+        counters.stop();
+        double seconds = (nowMs() - start) / 1000.0;
+
+        long hitCount = 0, mismatches = 0;
+        for (size_t i = 0; i < out.size(); i++) {
+            hitCount += out[i].tri != -1;
+            mismatches += out[i].tri != reference[i].tri || out[i].t != reference[i].t;
+        }
+        printf("%-14s %10.3f %12.3f", rayOrderName(order), batch.sortMs, batch.size() / seconds / 1e6);
+        if (counters.available) {
+            for (int c = 0; c < PerfCounters::COUNT; c++)
+                printf(" %14llu", (unsigned long long) counters.values[c]);
+            printf(" %12.3f", (double) counters.values[PerfCounters::CacheMisses] / batch.size());
+        }
+        printf(" %10ld %12ld\n", hitCount, mismatches);
+    }
+    counters.close();
+}
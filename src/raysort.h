@@ -0,0 +1,67 @@
+#pragma once
+
+#include "bvh.h"
+#include "trace.h"
+
+#include <stdint.h>
+
+#include <span>
+#include <vector>
+
+// order a RayBatch traces its rays in
+enum class RayOrder {
+    Submission,  // as pushed
+    Origin,      // morton order of the origin cell
+    OctantOrigin // direction octant first, then morton order of the origin cell
+};
+
+const char* rayOrderName(RayOrder order);
+
+struct QueuedRay {
+    float origin[3];
+    float direction[3];
+    int id; // where the hit goes in trace's output
+};
+
+// buffers rays that would otherwise be traced one by one in whatever order the shading made them (every bounce
+// of every pixel goes somewhere random) and traces them sorted, so consecutive rays start close together and head
+// the same way and walk mostly the same nodes while they are still in cache. keys are 10 bits per axis of morton
+// code over the scene bounds with the 3 bit direction octant on top, packed with the ray index into one 64 bit
+// value so the sort moves 8 bytes per ray
+class RayBatch {
+public:
+    // origins are quantized inside this box (the root node's bounds)
+    explicit RayBatch(const BVHNode & root);
+
+    void clear() { rays.clear(); }
+    size_t size() const { return rays.size(); }
+    void push(const float* origin, const float* direction, int id);
+
+    // sorts, traces every ray with the stackless traversal on threads threads and writes hits[id]
+    void trace(std::span<const BVHNode> nodes, std::span<const Triangle> triangles, RayOrder order, std::span<HitInfo> hits, int threads = 1);
+
+    // the same with occludedBVHStackless, occluded[id] is 1 when something is closer than tMax
+    void traceOcclusion(std::span<const BVHNode> nodes, std::span<const Triangle> triangles, RayOrder order, float tMax,
+                        std::span<uint8_t> occluded, int threads = 1);
+
+    double sortMs = 0.0; // time the last trace spent building keys and sorting
+
+private:
+    uint64_t sortKey(const QueuedRay & ray, RayOrder order) const;
+    void sortRays(RayOrder order);
+    // fn(ray) for every ray in sorted order, in chunks spread over threads
+    template <typename Fn>
+    void forEachSorted(Fn fn, int threads);
+
+    std::vector<QueuedRay> rays;
+    std::vector<uint64_t> keys;
+    float sceneMin[3];
+    float cellScale[3];
+};
+
+// cosine weighted direction in the hemisphere around the unit normal n from two uniform numbers in [0, 1)
+void cosineSampleHemisphere(const float* n, float u1, float u2, float* dir);
+
+// incoherent secondary rays (cosine weighted hemisphere rays off every primary hit) traced in each RayOrder,
+// with rays/sec, the time spent sorting and cache counters, and a check that every order found the same hits
+void runRaySortBenchmark(const std::vector<BVHNode> & nodes, const std::vector<Triangle> & triangles, int width, int height);
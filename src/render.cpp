@@ -0,0 +1,225 @@
+#include "render.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+const int PRIMES[2 * ShadingOptions::MAX_BOUNCES] = {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53};
+
+float radicalInverse(int base, uint32_t index)
+{
+    float inverse = 1.0f / base;
+    float scale = inverse;
+    float result = 0.0f;
+    while (index > 0) {
+        result += (index % base) * scale;
+        index /= base;
+        scale *= inverse;
+    }
+    return result;
+}
+
+// pcg style hash to a float in [0, 1)
+float hashToUnit(uint32_t v)
+{
+    v = v * 747796405u + 2891336453u;
+    v = ((v >> ((v >> 28) + 4)) ^ v) * 277803737u;
+    v = (v >> 22) ^ v;
+    return (v >> 8) * (1.0f / 16777216.0f);
+}
+
+// sample of pixel (x, y) in dimensions 2 * dimension and 2 * dimension + 1
+void sample2D(int x, int y, int sample, int dimension, float & u1, float & u2)
+{
+    uint32_t pixel = (uint32_t) x * 73856093u ^ (uint32_t) y * 19349663u;
+    u1 = radicalInverse(PRIMES[2 * dimension], sample) + hashToUnit(pixel ^ (2 * dimension + 1) * 83492791u);
+    u2 = radicalInverse(PRIMES[2 * dimension + 1], sample) + hashToUnit(pixel ^ (2 * dimension + 2) * 83492791u);
+    // cosineSampleHemisphere wants [0, 1)
+    u1 = std::min(u1 - floorf(u1), 0.99999994f);
+    u2 = std::min(u2 - floorf(u2), 0.99999994f);
+}
+
+struct PathState {
+    float origin[3]; // hit point pushed off the surface
+    float normal[3]; // facing the ray that arrived
+    float direction[3]; // of the ray leaving origin, once it has been sampled
+    float throughput;
+    int pixel;       // within the tile
+    int sample;
+};
+
+// fills path with the surface hit.t along (ro, rd) lands on
+void startPath(std::span<const Triangle> triangles, const HitInfo & hit, const float* ro, const float* rd, PathState & path)
+{
+    const float OFFSET = 1e-4f; // off the surface so the next ray doesn't hit the triangle it leaves
+    vec3 n;
+    vec3_norm(n, triangles[hit.tri].normal);
+    if (vec3_mul_inner(n, rd) > 0.0f)
+        vec3_scale(n, n, -1.0f);
+    for (int a = 0; a < 3; a++) {
+        path.normal[a] = n[a];
+        path.origin[a] = ro[a] + hit.t * rd[a] + OFFSET * n[a];
+    }
+}
+
+long shadeTile(std::span<const BVHNode> nodes, std::span<const Triangle> triangles, mat4x4 const mvp,
+               Image & image, int x0, int y0, int x1, int y1, const ShadingOptions & shading)
+{
+    const int width = x1 - x0;
+    const int samples = std::max(1, shading.samples);
+    const int bounces = std::clamp(shading.bounces, 1, ShadingOptions::MAX_BOUNCES);
+
+    std::vector<float> radiance((size_t) width * (y1 - y0), 0.0f);
+    std::vector<PathState> paths;
+    long rays = 0;
+    for (int y = y0; y < y1; y++) {
+        float v = 1.0f - (y + 0.5f) / image.height;
+        for (int x = x0; x < x1; x++) {
+            vec3 ro, rd;
+            primaryRay(mvp, (x + 0.5f) / image.width, v, ro, rd);
+            HitInfo hit = closestHitFromBVHStackless(nodes, triangles, ro, rd);
+            rays++;
+            if (hit.tri == -1)
+                continue;
+            PathState path;
+            startPath(triangles, hit, ro, rd, path);
+            path.throughput = shading.albedo;
+            path.pixel = (y - y0) * width + (x - x0);
+            for (int s = 0; s < samples; s++) {
+                path.sample = s;
+                paths.push_back(path);
+            }
+        }
+    }
+
+    RayBatch batch(nodes[0]);
+    auto pushBounce = [&](int i, int dimension) {
+        PathState & path = paths[i];
+        float u1, u2;
+        sample2D(x0 + path.pixel % width, y0 + path.pixel / width, path.sample, dimension, u1, u2);
+        cosineSampleHemisphere(path.normal, u1, u2, path.direction);
+        batch.push(path.origin, path.direction, i);
+    };
+
+    if (shading.mode == ShadingMode::AmbientOcclusion) {
+        for (int i = 0; i < (int) paths.size(); i++)
+            pushBounce(i, 0);
+        std::vector<uint8_t> occluded(paths.size());
+        batch.traceOcclusion(nodes, triangles, shading.rayOrder, shading.aoDistance, occluded);
+        rays += batch.size();
+        for (size_t i = 0; i < paths.size(); i++)
+            radiance[paths[i].pixel] += occluded[i] ? 0.0f : 1.0f;
+    } else {
+        std::vector<int> active(paths.size());
+        for (size_t i = 0; i < paths.size(); i++)
+            active[i] = (int) i;
+        std::vector<HitInfo> hits(paths.size());
+        for (int bounce = 0; bounce < bounces && !active.empty(); bounce++) {
+            batch.clear();
+            for (int i : active)
+                pushBounce(i, bounce);
+            batch.trace(nodes, triangles, shading.rayOrder, hits);
+            rays += batch.size();
+
+            // a bounce that escapes sees the sky, one that hits carries on from there. whatever is still going
+            // after the last bounce adds nothing
+            size_t kept = 0;
+            for (int i : active) {
+                PathState & path = paths[i];
+                if (hits[i].tri == -1) {
+                    radiance[path.pixel] += path.throughput;
+                    continue;
+                }
+                float ro[3], rd[3];
+                std::copy(path.origin, path.origin + 3, ro);
+                std::copy(path.direction, path.direction + 3, rd);
+                startPath(triangles, hits[i], ro, rd, path);
+                path.throughput *= shading.albedo;
+                active[kept++] = i;
+            }
+            active.resize(kept);
+        }
+    }
+
+    for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x++) {
+            float value = radiance[(y - y0) * width + (x - x0)] / samples;
+            unsigned char* rgb = &image.pixels[3 * ((size_t) y * image.width + x)];
+            rgb[0] = rgb[1] = rgb[2] = (unsigned char) (255.0f * powf(std::min(value, 1.0f), 1.0f / 2.2f) + 0.5f);
+        }
+    }
+    return rays;
+}
+
+}
+
+const char* shadingModeName(ShadingMode mode)
+{
+    switch (mode) {
+    case ShadingMode::Normal: return "normal";
+    case ShadingMode::AmbientOcclusion: return "ao";
+    case ShadingMode::Diffuse: return "diffuse";
+    }
+    return "?";
+}
+
+bool parseShadingMode(const char* name, ShadingMode & mode)
+{
+    for (ShadingMode m : {ShadingMode::Normal, ShadingMode::AmbientOcclusion, ShadingMode::Diffuse}) {
+        if (strcmp(name, shadingModeName(m)) == 0) {
+            mode = m;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool writePPM(const char* path, const Image & image)
+{
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "Failed to open image for writing: %s\n", path);
+        return false;
+    }
+    fprintf(file, "P6\n%d %d\n255\n", image.width, image.height);
+    fwrite(image.pixels.data(), 1, image.pixels.size(), file);
+    fclose(file);
+    return true;
+}
+
+void shadeHit(std::span<const Triangle> triangles, const HitInfo & hit, unsigned char* rgb)
+{
+    if (hit.tri == -1) {
+        rgb[0] = rgb[1] = rgb[2] = 0;
+        return;
+    }
+    vec3 n;
+    vec3_norm(n, triangles[hit.tri].normal);
+    for (int i = 0; i < 3; i++)
+        rgb[i] = (unsigned char) (255.0f * (n[i] * 0.5f + 0.5f) + 0.5f);
+}
+
+long renderTile(std::span<const BVHNode> nodes, std::span<const Triangle> triangles, mat4x4 const mvp,
+                Image & image, int x0, int y0, int x1, int y1, const ShadingOptions & shading)
+{
+    if (shading.mode != ShadingMode::Normal)
+        return shadeTile(nodes, triangles, mvp, image, x0, y0, x1, y1, shading);
+
+    for (int y = y0; y < y1; y++) {
+        // uv.y goes up the screen in the shader, image rows go down
+        float v = 1.0f - (y + 0.5f) / image.height;
+        for (int x = x0; x < x1; x++) {
+            vec3 ro, rd;
+            primaryRay(mvp, (x + 0.5f) / image.width, v, ro, rd);
+            HitInfo hit = closestHitFromBVHStackless(nodes, triangles, ro, rd);
+            shadeHit(triangles, hit, &image.pixels[3 * ((size_t) y * image.width + x)]);
+        }
+    }
+    return (long) (x1 - x0) * (y1 - y0);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "bvh.h"
+#include "raysort.h"
+#include "trace.h"
+
+#include <span>
+#include <vector>
+
+struct Image {
+    int width = 0;
+    int height = 0;
+    std::vector<unsigned char> pixels; // rgb, top row first
+};
+
+enum class ShadingMode {
+    Normal,           // the normal as a colour, what fs.glsl draws
+    AmbientOcclusion, // fraction of cosine weighted rays that get aoDistance away without hitting anything
+    Diffuse,          // grey lambertian surfaces lit by a white sky, up to bounces bounces
+};
+
+const char* shadingModeName(ShadingMode mode);
+bool parseShadingMode(const char* name, ShadingMode & mode);
+
+struct ShadingOptions {
+    ShadingMode mode = ShadingMode::Normal;
+    int samples = 16;         // per pixel, ao rays or paths
+    int bounces = 2;          // diffuse only, at most MAX_BOUNCES
+    float aoDistance = 0.1f;  // in the unit cube loadMesh fits the mesh into
+    float albedo = 0.7f;
+    RayOrder rayOrder = RayOrder::OctantOrigin; // order the secondary rays of a tile are traced in
+
+    static const int MAX_BOUNCES = 8;
+};
+
+// binary ppm, no dependencies needed to write it
+bool writePPM(const char* path, const Image & image);
+
+// the viewMode 0 shading from fs.glsl, the normal as a colour on a hit and black on a miss
+void shadeHit(std::span<const Triangle> triangles, const HitInfo & hit, unsigned char* rgb);
+
+// traces the pixels in [x0, x1) x [y0, y1) of image with the stackless traversal, returns the number of rays.
+// ao and diffuse shading trace the tile as a wavefront: every sample's next ray goes into one RayBatch, sorted by
+// shading.rayOrder and traced before the next bounce. samples come from a halton sequence, two dimensions per
+// bounce, shifted per pixel (Cranley-Patterson), so an image doesn't depend on how it was cut into tiles
+long renderTile(std::span<const BVHNode> nodes, std::span<const Triangle> triangles, mat4x4 const mvp,
+                Image & image, int x0, int y0, int x1, int y1, const ShadingOptions & shading = ShadingOptions());
@@ -14,9 +14,30 @@ uniform vec3 cameraPos;
 uniform mat4 MVP;
 out vec4 fragment;
 
+// frame time graph, samples in ms, oldest first
+const int HISTORY_SIZE = 128;
+uniform int showOverlay;
+uniform float gpuFrameTimes[HISTORY_SIZE];
+uniform float cpuFrameTimes[HISTORY_SIZE];
+
+// 0 = 64 entry stack, 1 = stackless using the escape links
+uniform int traversalMode;
+
+// 0 = bvh raytraced, 1 = naive raytraced (every triangle), 2 = box visualization
+uniform int viewMode;
+
 vec3 ro;
 vec3 rd;
 
+// 0 = Möller–Trumbore and the plain slab test
+// 1 = watertight triangle test (Woop et al. 2013) and a conservative slab test, no cracks along shared edges
+uniform int intersectMode;
+
+// per ray values for the watertight tests, filled in by setupRay
+vec3 invDir;
+int kx, ky, kz;
+vec3 shear;
+
 struct Triangle {
     vec4 v0;
     vec4 v1;
@@ -31,6 +52,10 @@ struct BVHNode {
     int right;
     int firstTri;
     int triCount;
+    int parent;
+    int escape;
+    int pad0;
+    int pad1;
 };
 
 layout(std430, binding = 0) buffer TriangleBuffer {
@@ -41,6 +66,40 @@ layout(std430, binding = 1) buffer BVHBuffer {
     BVHNode nodes[];
 };
 
+// 16 bit fixed point vertices inside the leaf box, see compress.h for the packing and the error bound
+struct PackedTriangle {
+    uint q[5]; // x0 y0 | z0 x1 | y1 z1 | x2 y2 | z2 -, low half first
+    int id;
+};
+
+layout(std430, binding = 2) buffer PackedTriangleBuffer {
+    PackedTriangle packedTriangles[];
+};
+
+// 0 = float triangles at binding 0, 1 = packed triangles at binding 2, only one of them is bound
+uniform int compressedTriangles;
+
+// same math as decodeTriangle in compress.h
+void leafTriangle(BVHNode leaf, int index, out vec3 v0, out vec3 v1, out vec3 v2)
+{
+    if (compressedTriangles == 0) {
+        Triangle tri = triangles[index];
+        v0 = tri.v0.xyz;
+        v1 = tri.v1.xyz;
+        v2 = tri.v2.xyz;
+        return;
+    }
+
+    PackedTriangle p = packedTriangles[index];
+    vec3 scale = (leaf.boundsMax.xyz - leaf.boundsMin.xyz) * (1.0 / 65535.0);
+    v0 = leaf.boundsMin.xyz + vec3(p.q[0] & 0xffffu, p.q[0] >> 16, p.q[1] & 0xffffu) * scale;
+    v1 = leaf.boundsMin.xyz + vec3(p.q[1] >> 16, p.q[2] & 0xffffu, p.q[2] >> 16) * scale;
+    v2 = leaf.boundsMin.xyz + vec3(p.q[3] & 0xffffu, p.q[3] >> 16, p.q[4] & 0xffffu) * scale;
+}
+
+// leaf the closest hit was found in, the packed triangles need it to decode the hit for shading
+int closestLeaf = -1;
+
 //slab method
 bool rayAABBIntersect(
     vec3 ro,
@@ -105,6 +164,105 @@ bool rayTriangleIntersect(
     return true;
 }
 
+void setupRay()
+{
+    // nudge zero components so the reciprocal stays finite and 0 * inf never makes a NaN
+    vec3 safeDir = rd;
+    for (int i = 0; i < 3; i++) {
+        if (abs(safeDir[i]) < 1e-20)
+            safeDir[i] = rd[i] < 0.0 ? -1e-20 : 1e-20;
+    }
+    invDir = 1.0 / safeDir;
+
+    vec3 a = abs(rd);
+    kz = a.x > a.y ? (a.x > a.z ? 0 : 2) : (a.y > a.z ? 1 : 2);
+    kx = (kz + 1) % 3;
+    ky = (kx + 1) % 3;
+    if (rd[kz] < 0.0) {
+        int tmp = kx;
+        kx = ky;
+        ky = tmp;
+    }
+    shear = vec3(rd[kx] / rd[kz], rd[ky] / rd[kz], 1.0 / rd[kz]);
+}
+
+// slab method with the reciprocal from setupRay, the far distance is pushed out by
+// the float rounding bound so it never culls a box the watertight test would hit
+bool rayAABBIntersectRobust(vec3 bmin, vec3 bmax)
+{
+    const float FAR_SCALE = 1.0000004;
+
+    vec3 t0 = (bmin - ro) * invDir;
+    vec3 t1 = (bmax - ro) * invDir;
+
+    vec3 tmin = min(t0, t1);
+    vec3 tmax = max(t0, t1) * FAR_SCALE;
+
+    float tNear = max(max(tmin.x, tmin.y), max(tmin.z, 0.0));
+    float tFar  = min(min(tmax.x, tmax.y), tmax.z);
+    return tNear <= tFar;
+}
+
+// shear and permute into ray space, then the 2d edge functions decide, in double when one is exactly zero
+bool rayTriangleIntersectWatertight(
+    vec3 v0,
+    vec3 v1,
+    vec3 v2,
+    out float tHit,
+    out vec3 hitPos
+) {
+    vec3 A = v0 - ro;
+    vec3 B = v1 - ro;
+    vec3 C = v2 - ro;
+
+    float Ax = A[kx] - shear.x * A[kz];
+    float Ay = A[ky] - shear.y * A[kz];
+    float Bx = B[kx] - shear.x * B[kz];
+    float By = B[ky] - shear.y * B[kz];
+    float Cx = C[kx] - shear.x * C[kz];
+    float Cy = C[ky] - shear.y * C[kz];
+
+    float U = Cx * By - Cy * Bx;
+    float V = Ax * Cy - Ay * Cx;
+    float W = Bx * Ay - By * Ax;
+
+    if (U == 0.0 || V == 0.0 || W == 0.0) {
+        U = float(double(Cx) * double(By) - double(Cy) * double(Bx));
+        V = float(double(Ax) * double(Cy) - double(Ay) * double(Cx));
+        W = float(double(Bx) * double(Ay) - double(By) * double(Ax));
+    }
+
+    if ((U < 0.0 || V < 0.0 || W < 0.0) && (U > 0.0 || V > 0.0 || W > 0.0))
+        return false;
+
+    float det = U + V + W;
+    if (det == 0.0)
+        return false;
+
+    float T = U * shear.z * A[kz] + V * shear.z * B[kz] + W * shear.z * C[kz];
+    float t = T / det;
+    if (t <= 0.0)
+        return false;
+
+    tHit = t;
+    hitPos = ro + t * rd;
+    return true;
+}
+
+bool boxHit(vec3 bmin, vec3 bmax)
+{
+    if (intersectMode == 1)
+        return rayAABBIntersectRobust(bmin, bmax);
+    return rayAABBIntersect(ro, rd, bmin, bmax);
+}
+
+bool triangleHit(vec3 v0, vec3 v1, vec3 v2, out float tHit, out vec3 hitPos)
+{
+    if (intersectMode == 1)
+        return rayTriangleIntersectWatertight(v0, v1, v2, tHit, hitPos);
+    return rayTriangleIntersect(ro, rd, v0, v1, v2, tHit, hitPos);
+}
+
 vec2 closestHitFromBVH()
 {
     const int MAX_STACK_SIZE = 64;
@@ -123,9 +281,7 @@ vec2 closestHitFromBVH()
         BVHNode node = nodes[nodeIndex];
 
         // AABB test
-        if (!rayAABBIntersect(
-                ro,
-                rd,
+        if (!boxHit(
                 node.boundsMin.xyz,
                 node.boundsMax.xyz))
         {
@@ -137,16 +293,15 @@ vec2 closestHitFromBVH()
         {
             for (int i = 0; i < node.triCount; i++)
             {
-                Triangle tri = triangles[node.firstTri + i];
+                vec3 v0, v1, v2;
+                leafTriangle(node, node.firstTri + i, v0, v1, v2);
 
                 float t;
                 vec3 hitPos;
-                if (rayTriangleIntersect(
-                        ro,
-                        rd,
-                        tri.v0.xyz,
-                        tri.v1.xyz,
-                        tri.v2.xyz,
+                if (triangleHit(
+                        v0,
+                        v1,
+                        v2,
                         t,
                         hitPos))
                 {
@@ -154,6 +309,7 @@ vec2 closestHitFromBVH()
                     {
                         closestT = t;
                         closestTri = node.firstTri + i;
+                        closestLeaf = nodeIndex;
                     }
                 }
             }
@@ -175,25 +331,110 @@ vec2 closestHitFromBVH()
     return vec2(closestT, float(closestTri));
 }
 
+// no stack: on a box hit go down to the left child, on a miss or after a leaf
+// follow the escape link to the next subtree. the root's escape is -1.
+vec2 closestHitFromBVHStackless()
+{
+    float closestT = 1e30;
+    int closestTri = -1;
+
+    int nodeIndex = 0;
+    while (nodeIndex != -1)
+    {
+        BVHNode node = nodes[nodeIndex];
+
+        if (!boxHit(
+                node.boundsMin.xyz,
+                node.boundsMax.xyz))
+        {
+            nodeIndex = node.escape;
+            continue;
+        }
+
+        if (node.left == -1 && node.right == -1)
+        {
+            for (int i = 0; i < node.triCount; i++)
+            {
+                vec3 v0, v1, v2;
+                leafTriangle(node, node.firstTri + i, v0, v1, v2);
+
+                float t;
+                vec3 hitPos;
+                if (triangleHit(
+                        v0,
+                        v1,
+                        v2,
+                        t,
+                        hitPos))
+                {
+                    if (t < closestT)
+                    {
+                        closestT = t;
+                        closestTri = node.firstTri + i;
+                        closestLeaf = nodeIndex;
+                    }
+                }
+            }
+            nodeIndex = node.escape;
+        }
+        else
+        {
+            nodeIndex = node.left;
+        }
+    }
+
+    return vec2(closestT, float(closestTri));
+}
+
+// bottom left graph, 2 px per frame, full height is 33.3 ms
+// grey bars are whole frame time on the cpu, green is the trace pass on the gpu
+bool drawOverlay(vec2 pixel, out vec4 color) {
+    const vec2 origin = vec2(8.0, 8.0);
+    const vec2 size = vec2(2.0 * HISTORY_SIZE, 100.0);
+    const float maxMs = 1000.0 / 30.0;
+
+    vec2 p = pixel - origin;
+    if (p.x < 0.0 || p.y < 0.0 || p.x >= size.x || p.y >= size.y)
+        return false;
+
+    int i = int(p.x / 2.0);
+    float ms = p.y / size.y * maxMs;
+
+    color = vec4(0.0, 0.0, 0.0, 1.0);
+    if (ms < cpuFrameTimes[i])
+        color = vec4(0.35, 0.35, 0.35, 1.0);
+    if (ms < gpuFrameTimes[i])
+        color = vec4(0.1, 0.85, 0.2, 1.0);
+    // 60 and 30 fps lines
+    if (abs(p.y - size.y * 0.5) < 0.5 || p.y > size.y - 1.0)
+        color = vec4(0.9, 0.9, 0.2, 1.0);
+    return true;
+}
 
 void main() {
-    // 0 = bvh raytraced, 1 = naive raytraced, 2 = box visualization
-    int viewMode = 2;
+    vec4 overlayColor;
+    if (showOverlay != 0 && drawOverlay(gl_FragCoord.xy, overlayColor)) {
+        fragment = overlayColor;
+        return;
+    }
+
     ro = (MVP*vec4(uv.x-0.5, uv.y-0.5, -1.0, 0.0)).xyz;
     rd = (MVP*vec4(0.0, 0.0, 1.0, 0.0)).xyz;
+    setupRay();
     
     bool hit = false;
     if (viewMode == 0) {
         fragment = vec4(1.0, 0.05, 0.05, 1.0);
         BVHNode b0 = nodes[0];
-        vec2 closestHit = closestHitFromBVH();
+        vec2 closestHit = traversalMode == 1 ? closestHitFromBVHStackless() : closestHitFromBVH();
         if (closestHit.y == -1) {
             //missed
             fragment = vec4(0.0, 0.0, 0.0, 1.0);
         } else {
             //hit, shade by normal
-            Triangle t = triangles[int(closestHit.y)];
-            vec3 hitNormal = normalize(t.normal.xyz);
+            vec3 v0, v1, v2;
+            leafTriangle(nodes[closestLeaf], int(closestHit.y), v0, v1, v2);
+            vec3 hitNormal = normalize(cross(v1 - v0, v2 - v0));
             fragment = vec4(hitNormal * 0.5 + 0.5, 1.0);
         }
         return;
@@ -202,15 +443,14 @@ void main() {
 
         vec3 hitNormal = vec3(0.0);
 
+        // walks the float triangles, nothing to draw with packed ones as a triangle can't be decoded without its leaf
         float closestT = 10000;
-        for (int i = 0; i < triangles.length(); i++) {
+        for (int i = 0; compressedTriangles == 0 && i < triangles.length(); i++) {
             Triangle tri = triangles[i];
 
             vec3 p;
             float t;
-            if (rayTriangleIntersect(
-                    ro,
-                    rd,
+            if (triangleHit(
                     tri.v0.xyz,
                     tri.v1.xyz,
                     tri.v2.xyz, t, p))
@@ -0,0 +1,53 @@
+#include "socket_io.h"
+
+#ifndef _WIN32
+
+#include <errno.h>
+#include <sys/socket.h>
+
+bool sendAll(int fd, const void* data, size_t size)
+{
+    const char* bytes = (const char*) data;
+    while (size > 0) {
+        ssize_t sent = send(fd, bytes, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return false;
+        bytes += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+bool recvAll(int fd, void* data, size_t size)
+{
+    char* bytes = (char*) data;
+    while (size > 0) {
+        ssize_t got = recv(fd, bytes, size, 0);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return false;
+        bytes += got;
+        size -= got;
+    }
+    return true;
+}
+
+bool sendMessage(int fd, uint32_t type, const void* payload, size_t size, const void* extra, size_t extraSize)
+{
+    MessageHeader header = {type, (uint32_t) (size + extraSize)};
+    return sendAll(fd, &header, sizeof(header)) && sendAll(fd, payload, size) && sendAll(fd, extra, extraSize);
+}
+
+void appendMessage(std::vector<char> & out, uint32_t type, const void* payload, size_t size, const void* extra, size_t extraSize)
+{
+    MessageHeader header = {type, (uint32_t) (size + extraSize)};
+    out.insert(out.end(), (const char*) &header, (const char*) &header + sizeof(header));
+    out.insert(out.end(), (const char*) payload, (const char*) payload + size);
+    if (extraSize > 0)
+        out.insert(out.end(), (const char*) extra, (const char*) extra + extraSize);
+}
+
+#endif
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+// blocking helpers for the framed messages the coordinator, workers and query server exchange over stream
+// sockets (POSIX only). every message is a header and then size bytes of payload. both ends are the same
+// build, so structs go over the wire as they are
+
+struct MessageHeader {
+    uint32_t type;
+    uint32_t size;
+};
+
+// retry on EINTR and short writes/reads, false once the socket fails or closes
+bool sendAll(int fd, const void* data, size_t size);
+bool recvAll(int fd, void* data, size_t size);
+
+// header, payload and an optional second part sent as one message
+bool sendMessage(int fd, uint32_t type, const void* payload, size_t size, const void* extra = nullptr, size_t extraSize = 0);
+
+// the same message framed onto the end of out, for a sender that queues its output and writes it when the
+// socket is ready
+void appendMessage(std::vector<char> & out, uint32_t type, const void* payload, size_t size, const void* extra = nullptr,
+                   size_t extraSize = 0);
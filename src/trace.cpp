@@ -0,0 +1,248 @@
+#include "trace.h"
+
+#include "kernels.h"
+
+#include <float.h>
+#include <math.h>
+
+#include <algorithm>
+
+bool rayAABBIntersect(vec3 const ro, vec3 const rd, float const* bmin, float const* bmax)
+{
+    float tNear = -INFINITY;
+    float tFar = INFINITY;
+    for (int i = 0; i < 3; i++) {
+        float invDir = 1.0f / rd[i];
+        float t0 = (bmin[i] - ro[i]) * invDir;
+        float t1 = (bmax[i] - ro[i]) * invDir;
+        tNear = std::max(tNear, std::min(t0, t1));
+        tFar = std::min(tFar, std::max(t0, t1));
+    }
+    return tFar >= std::max(tNear, 0.0f);
+}
+
+bool rayTriangleIntersect(vec3 const orig, vec3 const dir, float const* v0, float const* v1, float const* v2, float& tHit)
+{
+    const float EPSILON = 1e-6f;
+
+    vec3 e1, e2;
+    vec3_sub(e1, v1, v0);
+    vec3_sub(e2, v2, v0);
+
+    vec3 pvec;
+    vec3_mul_cross(pvec, dir, e2);
+    float det = vec3_mul_inner(e1, pvec);
+
+    if (fabsf(det) < EPSILON)
+        return false;
+
+    float invDet = 1.0f / det;
+
+    vec3 tvec;
+    vec3_sub(tvec, orig, v0);
+    float u = vec3_mul_inner(tvec, pvec) * invDet;
+    if (u < 0.0f || u > 1.0f)
+        return false;
+
+    vec3 qvec;
+    vec3_mul_cross(qvec, tvec, e1);
+    float v = vec3_mul_inner(dir, qvec) * invDet;
+    if (v < 0.0f || u + v > 1.0f)
+        return false;
+
+    float t = vec3_mul_inner(e2, qvec) * invDet;
+    if (t <= 0.0f)
+        return false;
+
+    tHit = t;
+    return true;
+}
+
+const char* intersectModeName(IntersectMode mode)
+{
+    return mode == IntersectMode::Watertight ? "watertight" : "fast";
+}
+
+void setupRay(Ray& ray, vec3 const ro, vec3 const rd)
+{
+    vec3_dup(ray.origin, ro);
+    vec3_dup(ray.dir, rd);
+    for (int i = 0; i < 3; i++) {
+        float d = rd[i];
+        if (fabsf(d) < 1e-20f)
+            d = copysignf(1e-20f, d);
+        ray.invDir[i] = 1.0f / d;
+    }
+
+    ray.kz = 0;
+    if (fabsf(rd[1]) > fabsf(rd[ray.kz]))
+        ray.kz = 1;
+    if (fabsf(rd[2]) > fabsf(rd[ray.kz]))
+        ray.kz = 2;
+    ray.kx = (ray.kz + 1) % 3;
+    ray.ky = (ray.kx + 1) % 3;
+    if (rd[ray.kz] < 0.0f)
+        std::swap(ray.kx, ray.ky);
+
+    ray.Sx = rd[ray.kx] / rd[ray.kz];
+    ray.Sy = rd[ray.ky] / rd[ray.kz];
+    ray.Sz = 1.0f / rd[ray.kz];
+}
+
+bool rayAABBIntersectRobust(const Ray& ray, float const* bmin, float const* bmax)
+{
+    // 1 + 2 * gamma(3) from pbrt, covers the rounding in the three operations behind each t
+    const float FAR_SCALE = 1.0f + 2.0f * (3.0f * 0.5f * FLT_EPSILON) / (1.0f - 3.0f * 0.5f * FLT_EPSILON);
+
+    float tNear = 0.0f;
+    float tFar = INFINITY;
+    for (int i = 0; i < 3; i++) {
+        float t0 = (bmin[i] - ray.origin[i]) * ray.invDir[i];
+        float t1 = (bmax[i] - ray.origin[i]) * ray.invDir[i];
+        if (t0 > t1)
+            std::swap(t0, t1);
+        t1 *= FAR_SCALE;
+        tNear = t0 > tNear ? t0 : tNear;
+        tFar = t1 < tFar ? t1 : tFar;
+    }
+    return tNear <= tFar;
+}
+
+bool rayTriangleIntersectWatertight(const Ray& ray, float const* v0, float const* v1, float const* v2, float& tHit)
+{
+    const int kx = ray.kx, ky = ray.ky, kz = ray.kz;
+
+    vec3 A, B, C;
+    vec3_sub(A, v0, ray.origin);
+    vec3_sub(B, v1, ray.origin);
+    vec3_sub(C, v2, ray.origin);
+
+    float Ax = A[kx] - ray.Sx * A[kz];
+    float Ay = A[ky] - ray.Sy * A[kz];
+    float Bx = B[kx] - ray.Sx * B[kz];
+    float By = B[ky] - ray.Sy * B[kz];
+    float Cx = C[kx] - ray.Sx * C[kz];
+    float Cy = C[ky] - ray.Sy * C[kz];
+
+    float U = Cx * By - Cy * Bx;
+    float V = Ax * Cy - Ay * Cx;
+    float W = Bx * Ay - By * Ax;
+
+    if (U == 0.0f || V == 0.0f || W == 0.0f) {
+        U = (float) ((double) Cx * By - (double) Cy * Bx);
+        V = (float) ((double) Ax * Cy - (double) Ay * Cx);
+        W = (float) ((double) Bx * Ay - (double) By * Ax);
+    }
+
+    // two sided, the edge functions just have to agree in sign
+    if ((U < 0.0f || V < 0.0f || W < 0.0f) && (U > 0.0f || V > 0.0f || W > 0.0f))
+        return false;
+
+    float det = U + V + W;
+    if (det == 0.0f)
+        return false;
+
+    float T = U * ray.Sz * A[kz] + V * ray.Sz * B[kz] + W * ray.Sz * C[kz];
+    float t = T / det;
+    if (t <= 0.0f)
+        return false;
+
+    tHit = t;
+    return true;
+}
+
+static inline bool triangleHit(const Ray& ray, float const* v0, float const* v1, float const* v2, IntersectMode mode, float& t)
+{
+    if (mode == IntersectMode::Watertight)
+        return rayTriangleIntersectWatertight(ray, v0, v1, v2, t);
+    return rayTriangleIntersect(ray.origin, ray.dir, v0, v1, v2, t);
+}
+
+// the loops are the kernels in kernels.cpp, these pick one per ray. batches pick theirs once with selectKernel
+template <Traversal T, typename Tri>
+static HitInfo closestHit(std::span<const BVHNode> nodes, std::span<const Tri> triangles, vec3 const ro, vec3 const rd, IntersectMode mode)
+{
+    Ray ray;
+    setupRay(ray, ro, rd);
+    if (mode == IntersectMode::Watertight)
+        return traceKernel<T, IntersectMode::Watertight, Query::ClosestHit, false>(nodes, triangles, ray, 1e30f, nullptr);
+    return traceKernel<T, IntersectMode::Fast, Query::ClosestHit, false>(nodes, triangles, ray, 1e30f, nullptr);
+}
+
+HitInfo closestHitFromBVH(std::span<const BVHNode> nodes, std::span<const Triangle> triangles, vec3 const ro, vec3 const rd,
+                          IntersectMode mode)
+{
+    return closestHit<Traversal::Stack>(nodes, triangles, ro, rd, mode);
+}
+
+HitInfo closestHitFromBVH(std::span<const BVHNode> nodes, std::span<const PackedTriangle> triangles, vec3 const ro, vec3 const rd,
+                          IntersectMode mode)
+{
+    return closestHit<Traversal::Stack>(nodes, triangles, ro, rd, mode);
+}
+
+HitInfo closestHitFromBVHStackless(std::span<const BVHNode> nodes, std::span<const Triangle> triangles, vec3 const ro, vec3 const rd,
+                                   IntersectMode mode)
+{
+    return closestHit<Traversal::Stackless>(nodes, triangles, ro, rd, mode);
+}
+
+HitInfo closestHitFromBVHStackless(std::span<const BVHNode> nodes, std::span<const PackedTriangle> triangles, vec3 const ro, vec3 const rd,
+                                   IntersectMode mode)
+{
+    return closestHit<Traversal::Stackless>(nodes, triangles, ro, rd, mode);
+}
+
+bool occludedBVHStackless(std::span<const BVHNode> nodes, std::span<const Triangle> triangles, vec3 const ro, vec3 const rd, float tMax,
+                          IntersectMode mode)
+{
+    Ray ray;
+    setupRay(ray, ro, rd);
+    if (mode == IntersectMode::Watertight)
+        return traceKernel<Traversal::Stackless, IntersectMode::Watertight, Query::AnyHit, false>(nodes, triangles, ray, tMax, nullptr).tri != -1;
+    return traceKernel<Traversal::Stackless, IntersectMode::Fast, Query::AnyHit, false>(nodes, triangles, ray, tMax, nullptr).tri != -1;
+}
+
+HitInfo closestHitBruteForce(std::span<const Triangle> triangles, vec3 const ro, vec3 const rd, IntersectMode mode)
+{
+    Ray ray;
+    setupRay(ray, ro, rd);
+
+    HitInfo hit;
+    for (int i = 0; i < (int) triangles.size(); i++) {
+        float t;
+        if (triangleHit(ray, triangles[i].v0, triangles[i].v1, triangles[i].v2, mode, t) && t < hit.t) {
+            hit.t = t;
+            hit.tri = i;
+        }
+    }
+    return hit;
+}
+
+void viewMatrix(mat4x4 mvp, float rotX, float rotY)
+{
+    mat4x4 rotXmat, rotYmat, model;
+    mat4x4_identity(rotXmat);
+    mat4x4_identity(rotYmat);
+    mat4x4_identity(model);
+    mat4x4_identity(mvp);
+    mat4x4_rotate_X(rotXmat, rotXmat, rotX);
+    mat4x4_rotate_Y(rotYmat, rotYmat, rotY);
+
+    // combine them
+    mat4x4_mul(model, rotYmat, rotXmat);
+
+    // create full MVP
+    mat4x4_mul(mvp, model, mvp);
+}
+
+void primaryRay(mat4x4 const mvp, float u, float v, vec3 ro, vec3 rd)
+{
+    vec4 o = {u - 0.5f, v - 0.5f, -1.0f, 0.0f};
+    vec4 d = {0.0f, 0.0f, 1.0f, 0.0f};
+    vec4 r;
+    mat4x4_mul_vec4(r, mvp, o);
+    vec3_dup(ro, r);
+    mat4x4_mul_vec4(r, mvp, d);
+    vec3_dup(rd, r);
+}
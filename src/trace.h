@@ -0,0 +1,74 @@
+#pragma once
+
+#include "bvh.h"
+#include "compress.h"
+#include "linmath.h"
+
+#include <span>
+
+// cpu versions of the kernels in shaders/fs.glsl, kept in step with them
+
+struct HitInfo {
+    float t = 1e30f;
+    int tri = -1; // -1 on a miss
+};
+
+enum class IntersectMode {
+    Fast,       // Möller–Trumbore with an epsilon and the plain slab test, what the shader always did
+    Watertight, // Woop et al. 2013 triangle test and a conservative slab test, no cracks along shared edges
+};
+
+const char* intersectModeName(IntersectMode mode);
+
+// everything the watertight tests need that only depends on the ray, worked out once per ray
+struct Ray {
+    vec3 origin;
+    vec3 dir;
+    vec3 invDir; // never inf, zero components are nudged to a tiny value of the right sign
+    int kx, ky, kz; // kz is the largest direction axis, kx/ky wind so the triangle keeps its orientation
+    float Sx, Sy, Sz; // shear that maps the ray onto +z
+};
+
+void setupRay(Ray& ray, vec3 const ro, vec3 const rd);
+
+//slab method
+bool rayAABBIntersect(vec3 const ro, vec3 const rd, float const* bmin, float const* bmax);
+
+// slab method with the precomputed reciprocal and the far distance pushed out by the
+// float rounding bound, so boxes a watertight triangle test would hit are never culled
+bool rayAABBIntersectRobust(const Ray& ray, float const* bmin, float const* bmax);
+
+//Möller–Trumbore
+bool rayTriangleIntersect(vec3 const orig, vec3 const dir, float const* v0, float const* v1, float const* v2, float& tHit);
+
+// shear and permute the triangle into ray space and test the 2d edge functions,
+// redone in double when one of them is exactly zero so neighbours agree about shared edges
+bool rayTriangleIntersectWatertight(const Ray& ray, float const* v0, float const* v1, float const* v2, float& tHit);
+
+// fixed 64 entry stack like the shader, drops the rest of the tree if it overflows
+HitInfo closestHitFromBVH(std::span<const BVHNode> nodes, std::span<const Triangle> triangles, vec3 const ro, vec3 const rd,
+                          IntersectMode mode = IntersectMode::Fast);
+
+// follows the escape links from linkBVH, no stack so any depth works
+HitInfo closestHitFromBVHStackless(std::span<const BVHNode> nodes, std::span<const Triangle> triangles, vec3 const ro, vec3 const rd,
+                                   IntersectMode mode = IntersectMode::Fast);
+
+// the same two traversals over packTriangles output, decoding each leaf's triangles as they are tested
+HitInfo closestHitFromBVH(std::span<const BVHNode> nodes, std::span<const PackedTriangle> triangles, vec3 const ro, vec3 const rd,
+                          IntersectMode mode = IntersectMode::Fast);
+HitInfo closestHitFromBVHStackless(std::span<const BVHNode> nodes, std::span<const PackedTriangle> triangles, vec3 const ro, vec3 const rd,
+                                   IntersectMode mode = IntersectMode::Fast);
+
+// any hit closer than tMax ends the walk, for ambient occlusion and shadow rays that only need a yes or no
+bool occludedBVHStackless(std::span<const BVHNode> nodes, std::span<const Triangle> triangles, vec3 const ro, vec3 const rd, float tMax,
+                          IntersectMode mode = IntersectMode::Fast);
+
+// every triangle, no bvh
+HitInfo closestHitBruteForce(std::span<const Triangle> triangles, vec3 const ro, vec3 const rd,
+                             IntersectMode mode = IntersectMode::Fast);
+
+// the rotation the viewer builds from the mouse drag angles
+void viewMatrix(mat4x4 mvp, float rotX, float rotY);
+
+// same camera as fs.glsl, orthographic with uv in [0, 1] across the screen
+void primaryRay(mat4x4 const mvp, float u, float v, vec3 ro, vec3 rd);
@@ -0,0 +1,205 @@
+#include "upload.h"
+
+#include "profiling.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+bool bufferStorageSupported()
+{
+#ifdef GL_VERSION_4_4
+    return GLAD_GL_VERSION_4_4 != 0;
+#else
+    return false;
+#endif
+}
+
+void DeviceBuffer::reserve(size_t bytes)
+{
+    size = bytes;
+    if (id != 0 && bytes <= capacity)
+        return;
+
+    destroy();
+    size = bytes;
+    capacity = std::max<size_t>(bytes + bytes / 8, 16);
+    glGenBuffers(1, &id);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, id);
+#ifdef GL_VERSION_4_4
+    if (bufferStorageSupported()) {
+        // only ever written by copies from the ring, or glBufferSubData when there is no ring
+        glBufferStorage(GL_SHADER_STORAGE_BUFFER, capacity, nullptr, GL_DYNAMIC_STORAGE_BIT);
+        return;
+    }
+#endif
+    glBufferData(GL_SHADER_STORAGE_BUFFER, capacity, nullptr, GL_DYNAMIC_DRAW);
+}
+
+void DeviceBuffer::bind(GLuint binding) const
+{
+    // a zero sized range is an error, an empty buffer is bound whole (the capacity is never 0)
+    if (size > 0)
+        glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, id, 0, size);
+    else
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, id);
+}
+
+void DeviceBuffer::destroy()
+{
+    if (id != 0)
+        glDeleteBuffers(1, &id);
+    id = 0;
+    capacity = 0;
+    size = 0;
+}
+
+UploadRing::~UploadRing()
+{
+    // the gl context may already be gone at exit, so only forget the handles
+    mapped = nullptr;
+}
+
+bool UploadRing::create(size_t bytesPerRegion)
+{
+    regionBytes = bytesPerRegion;
+#ifdef GL_VERSION_4_4
+    if (!bufferStorageSupported())
+        return false;
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+    glBufferStorage(GL_COPY_READ_BUFFER, REGIONS * regionBytes, nullptr, flags);
+    mapped = (char*) glMapBufferRange(GL_COPY_READ_BUFFER, 0, REGIONS * regionBytes, flags);
+    if (!mapped) {
+        glDeleteBuffers(1, &buffer);
+        buffer = 0;
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+void UploadRing::destroy()
+{
+    for (GLsync& fence : fences) {
+        if (fence)
+            glDeleteSync(fence);
+        fence = nullptr;
+    }
+    if (mapped) {
+        glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+        glUnmapBuffer(GL_COPY_READ_BUFFER);
+        mapped = nullptr;
+    }
+    if (buffer != 0)
+        glDeleteBuffers(1, &buffer);
+    buffer = 0;
+}
+
+void UploadRing::upload(DeviceBuffer & dst, size_t dstOffset, const void* src, size_t bytes)
+{
+    write(dst, dstOffset, bytes, [src](void* chunk, size_t offset, size_t chunkBytes) {
+        memcpy(chunk, (const char*) src + offset, chunkBytes);
+    });
+}
+
+void UploadRing::write(DeviceBuffer & dst, size_t dstOffset, size_t bytes, const std::function<void(void*, size_t, size_t)> & fill)
+{
+    bytesUploaded += bytes;
+    if (!mapped) {
+        // no persistent mapping, stage one chunk at a time through the driver instead
+        std::vector<char> staging(std::min(bytes, std::max<size_t>(regionBytes, 1)));
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, dst.id);
+        for (size_t offset = 0; offset < bytes; offset += staging.size()) {
+            size_t chunkBytes = std::min(staging.size(), bytes - offset);
+            fill(staging.data(), offset, chunkBytes);
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, dstOffset + offset, chunkBytes, staging.data());
+        }
+        return;
+    }
+
+    glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, dst.id);
+    for (size_t offset = 0; offset < bytes; offset += regionBytes) {
+        size_t chunkBytes = std::min(regionBytes, bytes - offset);
+        int region = next;
+        next = (next + 1) % REGIONS;
+
+        if (fences[region]) {
+            double waitStart = nowMs();
+            // the flush makes sure the fence was submitted, otherwise this could wait forever
+            while (glClientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED) {
+            }
+            glDeleteSync(fences[region]);
+            fences[region] = nullptr;
+            fenceWaitMs += nowMs() - waitStart;
+        }
+
+        // coherent mapping, nothing to flush once it is written
+        fill(mapped + region * regionBytes, offset, chunkBytes);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, region * regionBytes, dstOffset + offset, chunkBytes);
+        fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+}
+
+void runUploadBenchmark(const std::vector<BVHNode> & nodes, const std::vector<Triangle> & triangles)
+{
+    const size_t nodeBytes = nodes.size() * sizeof(BVHNode);
+    const size_t triangleBytes = triangles.size() * sizeof(Triangle);
+    const double totalMB = (nodeBytes + triangleBytes) / 1e6;
+    bool peakReset = resetPeakResident();
+    printf("uploading %.2f MB of nodes and triangles, buffer storage %s%s\n", totalMB,
+           bufferStorageSupported() ? "available" : "missing, ring falls back to glBufferSubData",
+           peakReset ? "" : ", peak memory can't be reset and covers the whole run");
+
+    printf("%-22s %10s %10s %14s %14s\n", "method", "ms", "GB/s", "peak extra MB", "fence wait ms");
+    auto report = [&](const char* name, double ms, size_t baseline, double waitMs) {
+        size_t peak = peakResidentBytes();
+        printf("%-22s %10.3f %10.3f %14.2f %14.3f\n", name, ms, totalMB / 1e3 / (ms / 1e3),
+               peak > baseline ? (peak - baseline) / 1e6 : 0.0, waitMs);
+    };
+
+    // the old way, the driver takes its own copy of each buffer
+    {
+        glFinish();
+        resetPeakResident();
+        size_t baseline = residentBytes();
+        double start = nowMs();
+        GLuint buffers[2];
+        glGenBuffers(2, buffers);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[0]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, nodeBytes, nodes.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[1]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, triangleBytes, triangles.data(), GL_STATIC_DRAW);
+        glFinish();
+        report("glBufferData", nowMs() - start, baseline, 0.0);
+        glDeleteBuffers(2, buffers);
+    }
+
+    for (size_t regionBytes : {(size_t) 1 << 20, (size_t) 8 << 20, (size_t) 64 << 20}) {
+        glFinish();
+        resetPeakResident();
+        size_t baseline = residentBytes();
+        double start = nowMs();
+        UploadRing ring;
+        ring.create(regionBytes);
+        DeviceBuffer nodeBuffer, triangleBuffer;
+        nodeBuffer.reserve(nodeBytes);
+        triangleBuffer.reserve(triangleBytes);
+        ring.upload(nodeBuffer, 0, nodes.data(), nodeBytes);
+        ring.upload(triangleBuffer, 0, triangles.data(), triangleBytes);
+        glFinish();
+        double ms = nowMs() - start;
+
+        char name[64];
+        snprintf(name, sizeof(name), "ring %d x %zu MB", UploadRing::REGIONS, regionBytes >> 20);
+        report(name, ms, baseline, ring.fenceWaitMs);
+        ring.destroy();
+        nodeBuffer.destroy();
+        triangleBuffer.destroy();
+    }
+}
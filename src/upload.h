@@ -0,0 +1,67 @@
+#pragma once
+
+#include <glad/gl.h>
+
+#include "bvh.h"
+
+#include <stddef.h>
+
+#include <functional>
+#include <vector>
+
+// true when the context has glBufferStorage (gl 4.4). everything below falls back to glBufferData and
+// glBufferSubData without it
+bool bufferStorageSupported();
+
+// a shader storage buffer on the gpu side. storage is immutable where possible, so it is recreated (and its contents
+// dropped) when something bigger than its capacity has to fit, with some headroom for edits that grow the bvh
+struct DeviceBuffer {
+    GLuint id = 0;
+    size_t capacity = 0;
+    size_t size = 0; // bytes in use, the range bind hands the shader so .length() stays right
+
+    void reserve(size_t bytes);
+    void bind(GLuint binding) const;
+    void destroy();
+};
+
+// streams uploads through one persistently and coherently mapped staging buffer split into REGIONS regions.
+// each chunk is written into the next region and copied into the destination with glCopyBufferSubData, and a
+// fence after the copy tells the next writer of that region when the gpu is done with it, so the cpu only
+// waits once it laps the gpu. an upload bigger than a region goes through in region sized chunks, which keeps
+// the extra host memory at REGIONS * regionBytes however large the buffer is, instead of a driver side copy of
+// the whole thing.
+//
+// write hands the mapped chunks to a fill callback, so a producer can write straight into them instead of
+// building a std::vector to upload from
+class UploadRing {
+public:
+    static const int REGIONS = 3;
+
+    ~UploadRing();
+
+    // false when glBufferStorage is missing, uploads then go through glBufferSubData
+    bool create(size_t regionBytes = 8 << 20);
+    void destroy();
+    bool persistent() const { return mapped != nullptr; }
+
+    // copies bytes from src into dst at dstOffset
+    void upload(DeviceBuffer & dst, size_t dstOffset, const void* src, size_t bytes);
+
+    // fill(chunk, offset, chunkBytes) writes bytes [offset, offset + chunkBytes) of the upload into chunk
+    void write(DeviceBuffer & dst, size_t dstOffset, size_t bytes, const std::function<void(void*, size_t, size_t)> & fill);
+
+    size_t regionBytes = 0;
+    size_t bytesUploaded = 0;
+    double fenceWaitMs = 0.0; // time spent waiting for the gpu to hand a region back
+
+private:
+    GLuint buffer = 0;
+    char* mapped = nullptr;
+    GLsync fences[REGIONS] = {};
+    int next = 0;
+};
+
+// upload bandwidth and peak extra host memory of glBufferData against the ring with a few region sizes.
+// needs a current gl context
+void runUploadBenchmark(const std::vector<BVHNode> & nodes, const std::vector<Triangle> & triangles);
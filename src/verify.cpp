@@ -0,0 +1,214 @@
+#include "verify.h"
+
+#include "bench.h"
+#include "bvh.h"
+#include "compress.h"
+#include "mesh.h"
+#include "parallel.h"
+#include "trace.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+
+namespace {
+
+// relative t difference still counted as the same hit
+const float T_TOLERANCE = 1e-5f;
+
+struct VerifyView {
+    mat4x4 mvp;
+};
+
+std::vector<VerifyView> verifyViews()
+{
+    std::vector<std::pair<float, float>> angles = benchmarkViews(8);
+    // axis aligned rays have zero direction components, which the slab test divides by
+    angles.push_back({0.0f, 0.0f});
+    angles.push_back({1.5707963f, 0.0f});
+    angles.push_back({0.0f, 1.5707963f});
+
+    std::vector<VerifyView> views(angles.size());
+    for (size_t i = 0; i < angles.size(); i++)
+        viewMatrix(views[i].mvp, angles[i].first, angles[i].second);
+    return views;
+}
+
+struct Mismatch {
+    int view = -1;
+    int x = 0;
+    int y = 0;
+    HitInfo expected;
+    HitInfo got;
+};
+
+struct CompareResult {
+    long mismatches = 0;
+    long ties = 0;
+    Mismatch first;
+};
+
+// ground truth ids are source triangle ids, so one set of brute force hits covers every build of the mesh
+std::vector<HitInfo> bruteForceHits(const std::vector<Triangle> & triangles, const std::vector<VerifyView> & views, IntersectMode mode,
+                                    const VerifyOptions & options)
+{
+    std::vector<HitInfo> hits((size_t) views.size() * options.width * options.height);
+    int rows = views.size() * options.height;
+    parallelFor(rows, [&](int row) {
+        const VerifyView & view = views[row / options.height];
+        int y = row % options.height;
+        for (int x = 0; x < options.width; x++) {
+            vec3 ro, rd;
+            primaryRay(view.mvp, (x + 0.5f) / options.width, (y + 0.5f) / options.height, ro, rd);
+            HitInfo hit = closestHitBruteForce(triangles, ro, rd, mode);
+            if (hit.tri != -1)
+                hit.tri = triangleId(triangles[hit.tri]);
+            hits[(size_t) row * options.width + x] = hit;
+        }
+    }, options.threads);
+    return hits;
+}
+
+template <typename Triangles>
+CompareResult compare(const std::vector<BVHNode> & nodes, const Triangles & triangles, bool stackless, IntersectMode mode,
+                      const std::vector<VerifyView> & views, const std::vector<HitInfo> & expected, const VerifyOptions & options)
+{
+    int rows = views.size() * options.height;
+    std::vector<CompareResult> perRow(rows);
+    parallelFor(rows, [&](int row) {
+        const VerifyView & view = views[row / options.height];
+        int y = row % options.height;
+        CompareResult & result = perRow[row];
+        for (int x = 0; x < options.width; x++) {
+            vec3 ro, rd;
+            primaryRay(view.mvp, (x + 0.5f) / options.width, (y + 0.5f) / options.height, ro, rd);
+            HitInfo got = stackless ? closestHitFromBVHStackless(nodes, triangles, ro, rd, mode)
+                                    : closestHitFromBVH(nodes, triangles, ro, rd, mode);
+            if (got.tri != -1)
+                got.tri = triangleId(triangles[got.tri]);
+            const HitInfo & want = expected[(size_t) row * options.width + x];
+
+            // the same triangle has to be hit at the same distance, a different one only counts if it is a tie
+            bool sameT = got.tri != -1 && want.tri != -1 && fabsf(got.t - want.t) <= T_TOLERANCE * std::max(1.0f, fabsf(want.t));
+            if (got.tri == want.tri && (got.tri == -1 || sameT))
+                continue;
+            if (got.tri != want.tri && sameT) {
+                result.ties++;
+                continue;
+            }
+            if (result.mismatches++ == 0)
+                result.first = {row / options.height, x, y, want, got};
+        }
+    }, options.threads);
+
+    CompareResult total;
+    for (const CompareResult & r : perRow) {
+        if (r.mismatches > 0 && total.mismatches == 0)
+            total.first = r.first;
+        total.mismatches += r.mismatches;
+        total.ties += r.ties;
+    }
+    return total;
+}
+
+void printFirstMismatch(const CompareResult & result)
+{
+    const Mismatch & m = result.first;
+    printf("      first at view %d pixel (%d, %d): expected tri %d t %.7g, got tri %d t %.7g\n",
+           m.view, m.x, m.y, m.expected.tri, m.expected.t, m.got.tri, m.got.t);
+}
+
+}
+
+int runVerify(const VerifyOptions & options)
+{
+    const std::vector<VerifyView> views = verifyViews();
+    int failures = 0;
+    int configs = 0;
+
+    for (const char* path : options.meshes) {
+        std::vector<Triangle> source;
+        aiVector3D min, max;
+        if (!loadMesh(path, source, min, max))
+            return EXIT_FAILURE;
+
+        // each intersection mode is checked against brute force with the same test, the two can disagree on edges
+        std::vector<HitInfo> expected[2] = {bruteForceHits(source, views, IntersectMode::Fast, options),
+                                            bruteForceHits(source, views, IntersectMode::Watertight, options)};
+
+        for (bool sbvh : {false, true}) {
+            for (NodeLayout layout : {NodeLayout::Recursion, NodeLayout::DepthFirst, NodeLayout::VanEmdeBoas, NodeLayout::Treelet}) {
+                for (bool reorder : {false, true}) {
+                    BuildSettings settings;
+                    settings.sbvh = sbvh;
+                    settings.layout = layout;
+                    settings.reorderTriangles = reorder;
+
+                    std::vector<Triangle> triangles = source;
+                    std::vector<BVHNode> nodes;
+                    buildAccelerationStructure(nodes, triangles, min, max, settings);
+
+                    for (IntersectMode mode : {IntersectMode::Fast, IntersectMode::Watertight}) {
+                        for (bool stackless : {false, true}) {
+                            CompareResult result = compare(nodes, triangles, stackless, mode, views, expected[(int) mode], options);
+                            configs++;
+                            printf("%-5s %s %-8s %-9s %-9s %-9s %-10s %ld mismatches, %ld ties\n",
+                                   result.mismatches ? "FAIL" : "ok", path, sbvh ? "sbvh" : "midpoint", nodeLayoutName(layout),
+                                   reorder ? "reordered" : "as built", stackless ? "stackless" : "stack", intersectModeName(mode),
+                                   result.mismatches, result.ties);
+                            if (result.mismatches) {
+                                failures++;
+                                printFirstMismatch(result);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        // packed triangles are checked against brute force over the decoded triangles, quantization moves
+        // the vertices so the float ground truth above would not match
+        for (bool sbvh : {false, true}) {
+            for (bool reorder : {false, true}) {
+                BuildSettings settings;
+                settings.sbvh = sbvh;
+                settings.reorderTriangles = reorder;
+
+                std::vector<Triangle> triangles = source;
+                std::vector<BVHNode> nodes;
+                buildAccelerationStructure(nodes, triangles, min, max, settings);
+
+                std::vector<PackedTriangle> packed;
+                float maxError;
+                bool withinBound = packTriangles(nodes, triangles, 0, packed, maxError);
+                std::vector<Triangle> decoded;
+                unpackTriangles(nodes, packed, 0, decoded);
+                configs++;
+                printf("%-5s %s %-8s %-9s packed, max vertex error %.3g\n", withinBound ? "ok" : "FAIL", path, sbvh ? "sbvh" : "midpoint",
+                       reorder ? "reordered" : "as built", maxError);
+                if (!withinBound)
+                    failures++;
+
+                for (IntersectMode mode : {IntersectMode::Fast, IntersectMode::Watertight}) {
+                    std::vector<HitInfo> decodedExpected = bruteForceHits(decoded, views, mode, options);
+                    for (bool stackless : {false, true}) {
+                        CompareResult result = compare(nodes, packed, stackless, mode, views, decodedExpected, options);
+                        configs++;
+                        printf("%-5s %s %-8s %-9s packed    %-9s %-10s %ld mismatches, %ld ties\n",
+                               result.mismatches ? "FAIL" : "ok", path, sbvh ? "sbvh" : "midpoint", reorder ? "reordered" : "as built",
+                               stackless ? "stackless" : "stack", intersectModeName(mode), result.mismatches, result.ties);
+                        if (result.mismatches) {
+                            failures++;
+                            printFirstMismatch(result);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    printf("%d of %d configurations failed\n", failures, configs);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
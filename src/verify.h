@@ -0,0 +1,18 @@
+#pragma once
+
+#include <vector>
+
+struct VerifyOptions {
+    std::vector<const char*> meshes;
+    int width = 96;
+    int height = 96;
+    int threads = 0; // 0 uses every hardware thread
+};
+
+// regression check of the bvh against brute force. every mesh is built with each builder and node layout,
+// traced on the cpu with both traversals from a fixed set of views, and compared per pixel with
+// the closest hit over all triangles: hit or miss, the source triangle id and t must all agree.
+// two triangles hit at the same t (a ray through a shared edge) count as a tie, not a failure.
+// packed triangle storage is checked the same way against the decoded triangles, and must stay inside its error bound.
+// returns EXIT_FAILURE if any configuration had a mismatch
+int runVerify(const VerifyOptions & options);